@@ -398,13 +398,18 @@ usteer_candidate_list_add_sta_reported(struct usteer_candidate_list *cl, struct
 	if (!own_mr)
 		return;
 
-	current_signal = usteer_rcpi_to_rssi(own_mr->beacon_report.rcpi);
+	current_signal = usteer_measurement_report_signal(own_mr);
 
 	list_for_each_entry(mr, &si->sta->measurements, sta_list) {
+		/* Sorted by age, the remaining reports are too old as well */
+		if (current_time - mr->timestamp > config.measurement_policy_timeout ||
+		    (signal_max_age && current_time - mr->timestamp > signal_max_age))
+			break;
+
 		if (!usteer_policy_node_selectable_by_sta_measurement(own_mr, mr, signal_max_age))
 			continue;
-		
-		signal = usteer_rcpi_to_rssi(mr->beacon_report.rcpi);
+
+		signal = usteer_measurement_report_signal(mr);
 
 		reasons = usteer_candidate_list_should_add_node(si->node, current_signal, mr->node,
 								signal,
@@ -423,18 +428,20 @@ usteer_candidate_list_add_sta_seen(struct usteer_candidate_list *cl, struct sta_
 {
 	struct sta_info *foreign_si;
 	uint32_t reasons;
+	int signal;
 
 	list_for_each_entry(foreign_si, &si->sta->nodes, list) {
 		if (!usteer_policy_node_selectable_by_sta(si, foreign_si, signal_max_age))
 			continue;
 
-		reasons = usteer_candidate_list_should_add_node(si->node, si->signal, foreign_si->node,
-								foreign_si->signal,
+		signal = usteer_sta_info_signal(foreign_si);
+		reasons = usteer_candidate_list_should_add_node(si->node, usteer_sta_info_signal(si),
+								foreign_si->node, signal,
 								node_ref_rating, required_criteria);
 		if (!reasons)
 			continue;
 
-		usteer_candidate_list_add_better_node(cl, foreign_si->node, foreign_si->signal, reasons);
+		usteer_candidate_list_add_better_node(cl, foreign_si->node, signal, reasons);
 	}
 }
 
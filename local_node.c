@@ -19,10 +19,6 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <net/ethernet.h>
-#ifdef linux
-#include <netinet/ether.h>
-#endif
 #include <net/if.h>
 #include <stdlib.h>
 
@@ -38,12 +34,20 @@ static char *node_up_script;
 static void
 usteer_local_node_state_reset(struct usteer_local_node *ln)
 {
-	if (ln->req_state == REQ_IDLE)
-		return;
+	int i;
 
-	ubus_abort_request(ubus_ctx, &ln->req);
-	uloop_timeout_cancel(&ln->req_timer);
-	ln->req_state = REQ_IDLE;
+	for (i = 0; i < __REQ_MAX; i++) {
+		if (!ln->req[i].pending)
+			continue;
+
+		ubus_abort_request(ubus_ctx, &ln->req[i].req);
+		ln->req[i].pending = false;
+	}
+
+	ln->status_valid = false;
+	ln->rrm_own_valid = false;
+	free(ln->rrm_nr_set);
+	ln->rrm_nr_set = NULL;
 }
 
 static void
@@ -70,13 +74,14 @@ usteer_free_node(struct ubus_context *ctx, struct usteer_local_node *ln)
 
 	usteer_local_node_pending_bss_tm_free(ln);
 	usteer_local_node_state_reset(ln);
+	usteer_ubus_cmd_cleanup(ln);
 	usteer_sta_node_cleanup(&ln->node);
 	usteer_measurement_report_node_cleanup(&ln->node);
 	uloop_timeout_cancel(&ln->update);
 	uloop_timeout_cancel(&ln->bss_tm_queries_timeout);
 	avl_delete(&local_nodes, &ln->node.avl);
 	ubus_unregister_subscriber(ctx, &ln->ev);
-	kvlist_free(&ln->node_info);
+	free(ln->node.node_info);
 	free(ln);
 }
 
@@ -118,7 +123,6 @@ usteer_handle_bss_tm_query(struct usteer_local_node *ln, struct blob_attr *msg)
 	};
 	struct blob_attr *tb[__BSS_TM_QUERY_MAX];
 	struct usteer_bss_tm_query *query;
-	uint8_t *sta_addr;
 
 	blobmsg_parse(policy, __BSS_TM_QUERY_MAX, tb, blob_data(msg), blob_len(msg));
 
@@ -130,12 +134,12 @@ usteer_handle_bss_tm_query(struct usteer_local_node *ln, struct blob_attr *msg)
 		return 0;
 
 	query->dialog_token = blobmsg_get_u8(tb[BSS_TM_QUERY_DIALOG_TOKEN]);
+	query->received = current_time;
 
-	sta_addr = (uint8_t *) ether_aton(blobmsg_get_string(tb[BSS_TM_QUERY_ADDRESS]));
-	if (!sta_addr)
+	if (!usteer_parse_mac(blobmsg_get_string(tb[BSS_TM_QUERY_ADDRESS]), query->sta_addr)) {
+		free(query);
 		return 0;
-
-	memcpy(query->sta_addr, sta_addr, 6);
+	}
 
 	list_add(&query->list, &ln->bss_tm_queries);
 	uloop_timeout_set(&ln->bss_tm_queries_timeout, 1);
@@ -158,15 +162,14 @@ usteer_handle_bss_tm_response(struct usteer_local_node *ln, struct blob_attr *ms
 	struct blob_attr *tb[__BSS_TM_RESPONSE_MAX];
 	struct sta_info *si;
 	struct sta *sta;
-	uint8_t *sta_addr;
+	uint8_t sta_addr[6];
 
 	blobmsg_parse(policy, __BSS_TM_RESPONSE_MAX, tb, blob_data(msg), blob_len(msg));
 
 	if (!tb[BSS_TM_RESPONSE_ADDRESS] || !tb[BSS_TM_RESPONSE_STATUS_CODE])
 		return 0;
 
-	sta_addr = (uint8_t *) ether_aton(blobmsg_get_string(tb[BSS_TM_RESPONSE_ADDRESS]));
-	if (!sta_addr)
+	if (!usteer_parse_mac(blobmsg_get_string(tb[BSS_TM_RESPONSE_ADDRESS]), sta_addr))
 		return 0;
 
 	sta = usteer_sta_get(sta_addr, false);
@@ -183,62 +186,193 @@ usteer_handle_bss_tm_response(struct usteer_local_node *ln, struct blob_attr *ms
 	return 0;
 }
 
-static int
-usteer_local_node_handle_beacon_report(struct usteer_local_node *ln, struct blob_attr *msg)
+enum {
+	BR_ADDRESS,
+	BR_BSSID,
+	BR_RCPI,
+	BR_RSNI,
+	BR_REPORTS,
+	__BR_MAX
+};
+
+static const struct blobmsg_policy beacon_report_policy[__BR_MAX] = {
+	[BR_ADDRESS] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
+	[BR_BSSID] = { .name = "bssid", .type = BLOBMSG_TYPE_STRING },
+	[BR_RCPI] = { .name = "rcpi", .type = BLOBMSG_TYPE_INT16 },
+	[BR_RSNI] = { .name = "rsni", .type = BLOBMSG_TYPE_INT16 },
+	[BR_REPORTS] = { .name = "reports", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+static bool
+usteer_local_node_add_beacon_report(struct sta *sta, struct blob_attr **tb)
 {
-	enum {
-		BR_ADDRESS,
-		BR_BSSID,
-		BR_RCPI,
-		BR_RSNI,
-		__BR_MAX
-	};
-	struct blobmsg_policy policy[__BR_MAX] = {
-		[BR_ADDRESS] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
-		[BR_BSSID] = { .name = "bssid", .type = BLOBMSG_TYPE_STRING },
-		[BR_RCPI] = { .name = "rcpi", .type = BLOBMSG_TYPE_INT16 },
-		[BR_RSNI] = { .name = "rsni", .type = BLOBMSG_TYPE_INT16 },
-	};
-	struct blob_attr *tb[__BR_MAX];
-
 	struct usteer_beacon_report br;
 	struct usteer_node *node;
-	uint8_t *addr;
-	struct sta *sta;
+	uint8_t bssid[6];
+
+	if (!tb[BR_BSSID] || !tb[BR_RCPI] || !tb[BR_RSNI])
+		return false;
 
-	MSG(FATAL, "Install BR");
+	if (!usteer_parse_mac(blobmsg_get_string(tb[BR_BSSID]), bssid))
+		return false;
+
+	node = usteer_node_by_bssid(bssid);
+	if (!node)
+		return false;
+
+	br.rcpi = (uint8_t)blobmsg_get_u16(tb[BR_RCPI]);
+	br.rsni = (uint8_t)blobmsg_get_u16(tb[BR_RSNI]);
+
+	return !!usteer_measurement_report_add_beacon_report(sta, node, &br, current_time);
+}
+
+/*
+ * Accepts either a single report ({ address, bssid, rcpi, rsni }) or a batch
+ * of reports for one station ({ address, reports: [ { bssid, rcpi, rsni } ] })
+ */
+static int
+usteer_local_node_handle_beacon_report(struct usteer_local_node *ln, struct blob_attr *msg)
+{
+	struct blob_attr *tb[__BR_MAX], *cur;
+	uint8_t addr[6];
+	struct sta *sta;
+	int n_reports = 0, n_added = 0;
+	int rem;
 
-	blobmsg_parse(policy, __BR_MAX, tb, blob_data(msg), blob_len(msg));
-	if (!tb[BR_ADDRESS] || !tb[BR_BSSID] || !tb[BR_RCPI] || !tb[BR_RSNI])
+	blobmsg_parse(beacon_report_policy, __BR_MAX, tb, blob_data(msg), blob_len(msg));
+	if (!tb[BR_ADDRESS])
 		return 0;
-	
-	addr = (uint8_t *) ether_aton(blobmsg_get_string(tb[BR_ADDRESS]));
-	if (!addr)
+
+	if (!usteer_parse_mac(blobmsg_get_string(tb[BR_ADDRESS]), addr))
 		return 0;
-	
+
 	sta = usteer_sta_get(addr, false);
 	if (!sta)
 		return 0;
-	
-	addr = (uint8_t *) ether_aton(blobmsg_get_string(tb[BR_BSSID]));
-	if (!addr)
+
+	if (!tb[BR_REPORTS]) {
+		n_reports = 1;
+		n_added = usteer_local_node_add_beacon_report(sta, tb);
+		goto out;
+	}
+
+	blobmsg_for_each_attr(cur, tb[BR_REPORTS], rem) {
+		struct blob_attr *tb_br[__BR_MAX];
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+			continue;
+
+		blobmsg_parse(beacon_report_policy, __BR_MAX, tb_br, blobmsg_data(cur), blobmsg_data_len(cur));
+		n_reports++;
+		n_added += usteer_local_node_add_beacon_report(sta, tb_br);
+	}
+
+out:
+	MSG(DEBUG, "Installed %d/%d beacon reports for sta=%s on %s\n",
+	    n_added, n_reports, blobmsg_get_string(tb[BR_ADDRESS]),
+	    usteer_node_name(&ln->node));
+	return 0;
+}
+
+static void
+usteer_local_node_sta_connected(struct sta_info *si)
+{
+	struct usteer_remote_node *rn;
+	struct sta_info *remote_si;
+
+	if (si->connected == STA_NOT_CONNECTED) {
+		/* New connection. Check if STA roamed. */
+		for_each_remote_node(rn) {
+			remote_si = usteer_sta_info_get(si->sta, &rn->node, NULL);
+			if (!remote_si)
+				continue;
+
+			if (current_time - remote_si->last_connected < config.roam_process_timeout) {
+				rn->node.roam_events.source++;
+				/* Don't abort looking for roam sources here.
+				 * The client might have roamed via another node
+				 * within the roam-timeout.
+				 */
+			}
+		}
+	}
+	si->connected = STA_CONNECTED;
+}
+
+static int
+usteer_local_node_handle_sta_state(struct usteer_local_node *ln, struct blob_attr *msg,
+				   bool connected)
+{
+	static const struct blobmsg_policy policy = {
+		.name = "address",
+		.type = BLOBMSG_TYPE_STRING,
+	};
+	struct usteer_node *node = &ln->node;
+	struct blob_attr *tb;
+	struct sta_info *si;
+	struct sta *sta;
+	uint8_t addr[6];
+	bool create;
+
+	blobmsg_parse(&policy, 1, &tb, blob_data(msg), blob_len(msg));
+	if (!tb)
 		return 0;
-	node = usteer_node_by_bssid(addr);
-	if (!node)
+
+	if (!usteer_parse_mac(blobmsg_get_string(tb), addr))
 		return 0;
 
-	br.rcpi = (uint8_t)blobmsg_get_u16(tb[BR_RCPI]);
-	br.rsni = (uint8_t)blobmsg_get_u16(tb[BR_RSNI]);
+	sta = usteer_sta_get(addr, connected);
+	if (!sta)
+		return 0;
+
+	si = usteer_sta_info_get(sta, node, connected ? &create : NULL);
+	if (!si)
+		return 0;
+
+	if (!connected) {
+		if (si->connected != STA_CONNECTED)
+			return 0;
+
+		if (node->n_assoc > 0)
+			node->n_assoc--;
+		usteer_sta_disconnected(si);
+		MSG(VERBOSE, "station "MAC_ADDR_FMT" disconnected from node %s\n",
+			MAC_ADDR_DATA(si->sta->addr), usteer_node_name(node));
+		return 0;
+	}
+
+	if (si->connected == STA_CONNECTED)
+		return 0;
+
+	usteer_local_node_sta_connected(si);
+	si->last_connected = current_time;
+	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
+	node->n_assoc++;
+
+	/* Pick up the capabilities of the new client with the next update */
+	ln->reconcile_pending = true;
+
+	MSG(VERBOSE, "station "MAC_ADDR_FMT" connected to node %s\n",
+		MAC_ADDR_DATA(si->sta->addr), usteer_node_name(node));
 
-	usteer_measurement_report_add_beacon_report(sta, node, &br, current_time);
-	MSG(FATAL, "Install BR sta=%s bssid=%s\n", blobmsg_get_string(tb[BR_ADDRESS]), blobmsg_get_string(tb[BR_BSSID]));
 	return 0;
 }
 
 static int
-usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
-		   struct ubus_request_data *req, const char *method,
-		   struct blob_attr *msg)
+usteer_local_node_handle_sta_authorized(struct usteer_local_node *ln, struct blob_attr *msg)
+{
+	return usteer_local_node_handle_sta_state(ln, msg, true);
+}
+
+static int
+usteer_local_node_handle_disassoc(struct usteer_local_node *ln, struct blob_attr *msg)
+{
+	return usteer_local_node_handle_sta_state(ln, msg, false);
+}
+
+static int
+usteer_local_node_handle_sta_event(struct usteer_local_node *ln, struct blob_attr *msg,
+				   enum usteer_event_type ev_type)
 {
 	enum {
 		EVENT_ADDR,
@@ -253,39 +387,13 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 		[EVENT_TARGET] = { .name = "target", .type = BLOBMSG_TYPE_STRING },
 		[EVENT_FREQ] = { .name = "freq", .type = BLOBMSG_TYPE_INT32 },
 	};
-	enum usteer_event_type ev_type = __EVENT_TYPE_MAX;
 	struct blob_attr *tb[__EVENT_MAX];
-	struct usteer_local_node *ln;
-	struct usteer_node *node;
 	int signal = NO_SIGNAL;
 	int freq = 0;
 	const char *addr_str;
-	const uint8_t *addr;
-	int i;
+	uint8_t addr[6];
 	bool ret;
 
-	usteer_update_time();
-
-	ln = container_of(obj, struct usteer_local_node, ev.obj);
-
-	if(!strcmp(method, "bss-transition-query")) {
-		return usteer_handle_bss_tm_query(ln, msg);
-	} else if(!strcmp(method, "bss-transition-response")) {
-		return usteer_handle_bss_tm_response(ln, msg);
-	} else if(!strcmp(method, "beacon-report")) {
-		return usteer_local_node_handle_beacon_report(ln, msg);
-	}
-
-	for (i = 0; i < ARRAY_SIZE(event_types); i++) {
-		if (strcmp(method, event_types[i]) != 0)
-			continue;
-
-		ev_type = i;
-		break;
-	}
-
-	ln = container_of(obj, struct usteer_local_node, ev.obj);
-	node = &ln->node;
 	blobmsg_parse(policy, __EVENT_MAX, tb, blob_data(msg), blob_len(msg));
 	if (!tb[EVENT_ADDR] || !tb[EVENT_FREQ])
 		return UBUS_STATUS_INVALID_ARGUMENT;
@@ -297,18 +405,110 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 		freq = blobmsg_get_u32(tb[EVENT_FREQ]);
 
 	addr_str = blobmsg_data(tb[EVENT_ADDR]);
-	addr = (uint8_t *) ether_aton(addr_str);
-	if (!addr)
+	if (!usteer_parse_mac(addr_str, addr))
 		return UBUS_STATUS_INVALID_ARGUMENT;
 
-	ret = usteer_handle_sta_event(node, addr, ev_type, freq, signal);
+	ret = usteer_handle_sta_event(&ln->node, addr, ev_type, freq, signal);
 
 	MSG(DEBUG, "received %s event from %s, signal=%d, freq=%d, handled:%s\n",
-	    method, addr_str, signal, freq, ret ? "true" : "false");
+	    event_types[ev_type], addr_str, signal, freq, ret ? "true" : "false");
 
 	return ret ? 0 : 17 /* WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA */;
 }
 
+enum {
+	LOCAL_EV_PROBE,
+	LOCAL_EV_AUTH,
+	LOCAL_EV_ASSOC,
+	LOCAL_EV_DISASSOC,
+	LOCAL_EV_DEAUTH,
+	LOCAL_EV_BEACON_REPORT,
+	LOCAL_EV_STA_AUTHORIZED,
+	LOCAL_EV_BSS_TM_QUERY,
+	LOCAL_EV_BSS_TM_RESPONSE,
+	__LOCAL_EV_MAX
+};
+
+static const struct {
+	const char *name;
+	int (*cb)(struct usteer_local_node *ln, struct blob_attr *msg);
+	enum usteer_event_type ev_type;
+} local_events[__LOCAL_EV_MAX] = {
+	[LOCAL_EV_PROBE] = { "probe", NULL, EVENT_TYPE_PROBE },
+	[LOCAL_EV_AUTH] = { "auth", NULL, EVENT_TYPE_AUTH },
+	[LOCAL_EV_ASSOC] = { "assoc", NULL, EVENT_TYPE_ASSOC },
+	[LOCAL_EV_DISASSOC] = { "disassoc", usteer_local_node_handle_disassoc },
+	[LOCAL_EV_DEAUTH] = { "deauth", usteer_local_node_handle_disassoc },
+	[LOCAL_EV_BEACON_REPORT] = { "beacon-report", usteer_local_node_handle_beacon_report },
+	[LOCAL_EV_STA_AUTHORIZED] = { "sta-authorized", usteer_local_node_handle_sta_authorized },
+	[LOCAL_EV_BSS_TM_QUERY] = { "bss-transition-query", usteer_handle_bss_tm_query },
+	[LOCAL_EV_BSS_TM_RESPONSE] = { "bss-transition-response", usteer_handle_bss_tm_response },
+};
+
+/* All method names differ in length or first character */
+static int
+usteer_local_node_event_id(const char *method)
+{
+	size_t len = strlen(method);
+	int id;
+
+	switch (len) {
+	case 4:
+		id = LOCAL_EV_AUTH;
+		break;
+	case 5:
+		id = method[0] == 'p' ? LOCAL_EV_PROBE : LOCAL_EV_ASSOC;
+		break;
+	case 6:
+		id = LOCAL_EV_DEAUTH;
+		break;
+	case 8:
+		id = LOCAL_EV_DISASSOC;
+		break;
+	case 13:
+		id = LOCAL_EV_BEACON_REPORT;
+		break;
+	case 14:
+		id = LOCAL_EV_STA_AUTHORIZED;
+		break;
+	case 20:
+		id = LOCAL_EV_BSS_TM_QUERY;
+		break;
+	case 23:
+		id = LOCAL_EV_BSS_TM_RESPONSE;
+		break;
+	default:
+		return -1;
+	}
+
+	if (memcmp(method, local_events[id].name, len) != 0)
+		return -1;
+
+	return id;
+}
+
+static int
+usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
+		   struct ubus_request_data *req, const char *method,
+		   struct blob_attr *msg)
+{
+	struct usteer_local_node *ln;
+	int id;
+
+	usteer_update_time();
+
+	ln = container_of(obj, struct usteer_local_node, ev.obj);
+
+	id = usteer_local_node_event_id(method);
+	if (id < 0)
+		return 0;
+
+	if (local_events[id].cb)
+		return local_events[id].cb(ln, msg);
+
+	return usteer_local_node_handle_sta_event(ln, msg, local_events[id].ev_type);
+}
+
 static void
 usteer_local_node_assoc_update(struct sta_info *si, struct blob_attr *data)
 {
@@ -320,29 +520,10 @@ usteer_local_node_assoc_update(struct sta_info *si, struct blob_attr *data)
 		[MSG_ASSOC] = { "assoc", BLOBMSG_TYPE_BOOL },
 	};
 	struct blob_attr *tb[__MSG_MAX];
-	struct usteer_remote_node *rn;
-	struct sta_info *remote_si;
 
 	blobmsg_parse(policy, __MSG_MAX, tb, blobmsg_data(data), blobmsg_data_len(data));
-	if (tb[MSG_ASSOC] && blobmsg_get_u8(tb[MSG_ASSOC])) {
-		if (si->connected == STA_NOT_CONNECTED) {
-			/* New connection. Check if STA roamed. */
-			for_each_remote_node(rn) {
-				remote_si = usteer_sta_info_get(si->sta, &rn->node, NULL);
-				if (!remote_si)
-					continue;
-
-				if (current_time - remote_si->last_connected < config.roam_process_timeout) {
-					rn->node.roam_events.source++;
-					/* Don't abort looking for roam sources here.
-					 * The client might have roamed via another node
-					 * within the roam-timeout.
-					 */
-				}
-			}
-		}
-		si->connected = STA_CONNECTED;
-	}
+	if (tb[MSG_ASSOC] && blobmsg_get_u8(tb[MSG_ASSOC]))
+		usteer_local_node_sta_connected(si);
 }
 
 static void
@@ -370,11 +551,34 @@ usteer_local_node_update_sta_rrm(const uint8_t *addr, struct blob_attr *client_a
 	sta->rrm = blobmsg_get_u32(blobmsg_data(sta_blob));
 }
 
+/* Update the statistics of connected stations from the node handlers */
 static void
-usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
+usteer_local_node_update_stations(struct usteer_local_node *ln)
 {
 	struct usteer_node *node = &ln->node;
 	struct usteer_node_handler *h;
+	struct sta_info *si;
+
+	list_for_each_entry(h, &node_handlers, list) {
+		if (h->update_stations) {
+			h->update_stations(node);
+			continue;
+		}
+
+		if (!h->update_sta)
+			continue;
+
+		list_for_each_entry(si, &node->sta_info, node_list) {
+			if (si->connected == STA_CONNECTED)
+				h->update_sta(node, si);
+		}
+	}
+}
+
+static void
+usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
+{
+	struct usteer_node *node = &ln->node;
 	struct blob_attr *cur;
 	struct sta_info *si;
 	struct sta *sta;
@@ -382,6 +586,8 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 	int rem;
 
 	usteer_update_time();
+	ln->last_reconcile = current_time;
+	ln->reconcile_pending = false;
 
 	list_for_each_entry(si, &node->sta_info, node_list) {
 		if (si->connected)
@@ -389,20 +595,14 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 	}
 
 	blobmsg_for_each_attr(cur, cl, rem) {
-		uint8_t *addr = (uint8_t *) ether_aton(blobmsg_name(cur));
+		uint8_t addr[6];
 		bool create;
 
-		if (!addr)
+		if (!usteer_parse_mac(blobmsg_name(cur), addr))
 			continue;
 
 		sta = usteer_sta_get(addr, true);
 		si = usteer_sta_info_get(sta, node, &create);
-		list_for_each_entry(h, &node_handlers, list) {
-			if (!h->update_sta)
-				continue;
-
-			h->update_sta(node, si);
-		}
 		usteer_local_node_assoc_update(si, cur);
 		if (si->connected == STA_CONNECTED) {
 			si->last_connected = current_time;
@@ -413,6 +613,7 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 		usteer_local_node_update_sta_rrm(addr, cur);
 	}
 
+	usteer_local_node_update_stations(ln);
 	node->n_assoc = n_assoc;
 
 	list_for_each_entry(si, &node->sta_info, node_list) {
@@ -438,11 +639,8 @@ usteer_local_node_list_cb(struct ubus_request *req, int type, struct blob_attr *
 		[MSG_CLIENTS] = { "clients", BLOBMSG_TYPE_TABLE },
 	};
 	struct blob_attr *tb[__MSG_MAX];
-	struct usteer_local_node *ln;
-	struct usteer_node *node;
-
-	ln = container_of(req, struct usteer_local_node, req);
-	node = &ln->node;
+	struct usteer_local_node *ln = req->priv;
+	struct usteer_node *node = &ln->node;
 
 	blobmsg_parse(policy, __MSG_MAX, tb, blob_data(msg), blob_len(msg));
 	if (!tb[MSG_FREQ] || !tb[MSG_CLIENTS])
@@ -467,19 +665,24 @@ usteer_local_node_status_cb(struct ubus_request *req, int type, struct blob_attr
 		[MSG_OP_CLASS] = { "op_class", BLOBMSG_TYPE_INT32 },
 	};
 	struct blob_attr *tb[__MSG_MAX];
-	struct usteer_local_node *ln;
-	struct usteer_node *node;
-
-	ln = container_of(req, struct usteer_local_node, req);
-	node = &ln->node;
+	struct usteer_local_node *ln = req->priv;
+	struct usteer_node *node = &ln->node;
+	int channel = node->channel;
 
 	blobmsg_parse(policy, __MSG_MAX, tb, blob_data(msg), blob_len(msg));
 	if (tb[MSG_FREQ])
 		node->freq = blobmsg_get_u32(tb[MSG_FREQ]);
 	if (tb[MSG_CHANNEL])
 		node->channel = blobmsg_get_u32(tb[MSG_CHANNEL]);
-	if (tb[MSG_FREQ])
-		node->op_class = blobmsg_get_u32(tb[MSG_OP_CLASS]);	
+	if (tb[MSG_OP_CLASS])
+		node->op_class = blobmsg_get_u32(tb[MSG_OP_CLASS]);
+
+	/* The own neighbor report contains the channel */
+	if (node->freq != ln->status_freq || node->channel != channel)
+		ln->rrm_own_valid = false;
+
+	ln->status_freq = node->freq;
+	ln->status_valid = true;
 }
 
 static void
@@ -488,25 +691,69 @@ usteer_local_node_rrm_nr_cb(struct ubus_request *req, int type, struct blob_attr
 	static const struct blobmsg_policy policy = {
 		"value", BLOBMSG_TYPE_ARRAY
 	};
-	struct usteer_local_node *ln;
+	struct usteer_local_node *ln = req->priv;
 	struct blob_attr *tb;
 
-	ln = container_of(req, struct usteer_local_node, req);
-
 	blobmsg_parse(&policy, 1, &tb, blob_data(msg), blob_len(msg));
 	if (!tb)
 		return;
 
 	usteer_node_set_blob(&ln->node.rrm_nr, tb);
+	ln->rrm_own_valid = true;
+}
+
+static void usteer_check_node_enabled(struct usteer_local_node *ln);
+
+static bool
+usteer_local_node_registering(struct usteer_local_node *ln)
+{
+	return ln->req[REQ_NOTIFY_RESPONSE].pending ||
+	       ln->req[REQ_BSS_MGMT_ENABLE].pending;
 }
 
 static void
 usteer_local_node_req_cb(struct ubus_request *req, int ret)
 {
-	struct usteer_local_node *ln;
+	struct usteer_local_node *ln = req->priv;
+	int i;
+
+	for (i = 0; i < __REQ_MAX; i++) {
+		if (req != &ln->req[i].req)
+			continue;
 
-	ln = container_of(req, struct usteer_local_node, req);
-	uloop_timeout_set(&ln->req_timer, 1);
+		ln->req[i].pending = false;
+		break;
+	}
+
+	switch (i) {
+	case REQ_RRM_SET_LIST:
+		/* Resend the neighbor list next time if hostapd did not take it */
+		if (ret) {
+			free(ln->rrm_nr_set);
+			ln->rrm_nr_set = NULL;
+		}
+		break;
+	case REQ_NOTIFY_RESPONSE:
+	case REQ_BSS_MGMT_ENABLE:
+		usteer_check_node_enabled(ln);
+		break;
+	}
+}
+
+static void
+usteer_local_node_req_start(struct usteer_local_node *ln, enum local_req_type type,
+			    const char *method, ubus_data_handler_t data_cb)
+{
+	struct ubus_request *req = &ln->req[type].req;
+
+	if (ubus_invoke_async(ubus_ctx, ln->obj_id, method, b.head, req))
+		return;
+
+	req->data_cb = data_cb;
+	req->complete_cb = usteer_local_node_req_cb;
+	req->priv = ln;
+	ln->req[type].pending = true;
+	ubus_complete_request_async(ubus_ctx, req);
 }
 
 static bool usteer_local_node_add_rrm_data(struct usteer_candidate *candidate)
@@ -549,43 +796,99 @@ usteer_local_node_prepare_rrm_set(struct usteer_local_node *ln)
 	usteer_candidate_list_free(cl);
 }
 
+static bool
+usteer_local_node_reconcile_due(struct usteer_local_node *ln)
+{
+	if (!config.local_sta_reconcile_interval || ln->reconcile_pending)
+		return true;
+
+	return current_time - ln->last_reconcile >= config.local_sta_reconcile_interval;
+}
+
+/* Refresh connected clients only, connection changes arrive as events */
 static void
-usteer_local_node_state_next(struct uloop_timeout *timeout)
+usteer_local_node_update_connected(struct usteer_local_node *ln)
 {
-	struct usteer_local_node *ln;
+	struct usteer_node *node = &ln->node;
+	struct sta_info *si;
 
-	ln = container_of(timeout, struct usteer_local_node, req_timer);
+	usteer_update_time();
+	usteer_local_node_update_stations(ln);
 
-	ln->req_state++;
-	if (ln->req_state >= __REQ_MAX) {
-		ln->req_state = REQ_IDLE;
-		return;
+	list_for_each_entry(si, &node->sta_info, node_list) {
+		if (si->connected == STA_CONNECTED)
+			si->last_connected = current_time;
 	}
+}
 
-	blob_buf_init(&b, 0);
-	switch (ln->req_state) {
-	case REQ_CLIENTS:
-		ubus_invoke_async(ubus_ctx, ln->obj_id, "get_clients", b.head, &ln->req);
-		ln->req.data_cb = usteer_local_node_list_cb;
-		break;
-	case REQ_STATUS:
-		ubus_invoke_async(ubus_ctx, ln->obj_id, "get_status", b.head, &ln->req);
-		ln->req.data_cb = usteer_local_node_status_cb;
-		break;
-	case REQ_RRM_SET_LIST:
+/* Requests still in flight from the last update are left alone */
+static void
+usteer_local_node_refresh(struct usteer_local_node *ln)
+{
+	struct usteer_node *node = &ln->node;
+	bool reconcile;
+
+	usteer_update_time();
+	reconcile = usteer_local_node_reconcile_due(ln);
+
+	if (!ln->req[REQ_CLIENTS].pending) {
+		if (reconcile) {
+			blob_buf_init(&b, 0);
+			usteer_local_node_req_start(ln, REQ_CLIENTS, "get_clients",
+						    usteer_local_node_list_cb);
+		} else {
+			usteer_local_node_update_connected(ln);
+		}
+	}
+
+	/* get_clients reports the frequency, so a channel change shows up there */
+	if (!ln->req[REQ_STATUS].pending &&
+	    (!ln->status_valid || reconcile || node->freq != ln->status_freq)) {
+		blob_buf_init(&b, 0);
+		usteer_local_node_req_start(ln, REQ_STATUS, "get_status",
+					    usteer_local_node_status_cb);
+	}
+
+	if (!ln->req[REQ_RRM_SET_LIST].pending) {
+		blob_buf_init(&b, 0);
 		usteer_local_node_prepare_rrm_set(ln);
-		ubus_invoke_async(ubus_ctx, ln->obj_id, "rrm_nr_set", b.head, &ln->req);
-		ln->req.data_cb = NULL;
-		break;
-	case REQ_RRM_GET_OWN:
-		ubus_invoke_async(ubus_ctx, ln->obj_id, "rrm_nr_get_own", b.head, &ln->req);
-		ln->req.data_cb = usteer_local_node_rrm_nr_cb;
-		break;
-	default:
-		break;
+		if (usteer_node_set_blob(&ln->rrm_nr_set, b.head))
+			usteer_local_node_req_start(ln, REQ_RRM_SET_LIST, "rrm_nr_set", NULL);
+	}
+
+	if (!ln->req[REQ_RRM_GET_OWN].pending && !ln->rrm_own_valid) {
+		blob_buf_init(&b, 0);
+		usteer_local_node_req_start(ln, REQ_RRM_GET_OWN, "rrm_nr_get_own",
+					    usteer_local_node_rrm_nr_cb);
+	}
+}
+
+static bool
+usteer_local_node_btm_nr_valid(struct sta_info *si)
+{
+	return si->btm.nr && !si->btm.stale &&
+	       current_time - si->btm.updated < USTEER_BTM_NR_MAX_AGE;
+}
+
+/*
+ * Recompute the BSS transition neighbor lists of connected stations whose
+ * measurements changed, or which queried before and whose list aged out,
+ * so that answering a query does not need a candidate search.
+ */
+static void
+usteer_local_node_btm_nr_update(struct usteer_local_node *ln)
+{
+	struct sta_info *si;
+
+	list_for_each_entry(si, &ln->node.sta_info, node_list) {
+		if (si->connected != STA_CONNECTED)
+			continue;
+
+		if (!si->btm.stale && (!si->btm.nr || usteer_local_node_btm_nr_valid(si)))
+			continue;
+
+		usteer_ubus_btm_nr_refresh(si);
 	}
-	ln->req.complete_cb = usteer_local_node_req_cb;
-	ubus_complete_request_async(ubus_ctx, &ln->req);
 }
 
 static void
@@ -605,9 +908,9 @@ usteer_local_node_update(struct uloop_timeout *timeout)
 		h->update_node(node);
 	}
 
-	usteer_local_node_state_reset(ln);
-	uloop_timeout_set(&ln->req_timer, 1);
+	usteer_local_node_refresh(ln);
 	usteer_local_node_kick(ln);
+	usteer_local_node_btm_nr_update(ln);
 	uloop_timeout_set(timeout, config.local_sta_update);
 }
 
@@ -634,7 +937,14 @@ usteer_local_node_process_bss_tm_queries(struct uloop_timeout *timeout)
 		if (!si)
 			continue;
 
-		usteer_ubus_bss_transition_request(si, query->dialog_token, false, false, validity_period);
+		ln->bss_tm.queries++;
+		if (usteer_local_node_btm_nr_valid(si))
+			ln->bss_tm.cache_hits++;
+		else
+			usteer_ubus_btm_nr_refresh(si);
+
+		usteer_ubus_bss_tm_query_response(si, query->dialog_token, validity_period,
+						  query->received);
 	}
 
 	/* Free pending queries we can not handle */
@@ -660,15 +970,15 @@ usteer_get_node(struct ubus_context *ctx, const char *name)
 	ln->ev.remove_cb = usteer_handle_remove;
 	ln->ev.cb = usteer_handle_event;
 	ln->update.cb = usteer_local_node_update;
-	ln->req_timer.cb = usteer_local_node_state_next;
+	ln->signal_check = true;
 	ubus_register_subscriber(ctx, &ln->ev);
 	avl_insert(&local_nodes, &node->avl);
-	kvlist_init(&ln->node_info, kvlist_blob_len);
 	INIT_LIST_HEAD(&node->sta_info);
 	INIT_LIST_HEAD(&node->measurements);
 
 	ln->bss_tm_queries_timeout.cb = usteer_local_node_process_bss_tm_queries;
 	INIT_LIST_HEAD(&ln->bss_tm_queries);
+	usteer_ubus_cmd_init(ln);
 	return ln;
 }
 
@@ -694,6 +1004,10 @@ usteer_check_node_enabled(struct usteer_local_node *ln)
 	struct blob_attr *cur;
 	int rem;
 
+	/* Wait for hostapd to confirm the registration requests */
+	if (usteer_local_node_registering(ln))
+		return;
+
 	blobmsg_for_each_attr(cur, config.ssid_list, rem) {
 		if (strcmp(blobmsg_get_string(cur), ln->node.ssid) != 0)
 			continue;
@@ -717,7 +1031,13 @@ usteer_check_node_enabled(struct usteer_local_node *ln)
 		return;
 	}
 
-	MSG(INFO, "Connecting to local node %s\n", usteer_node_name(&ln->node));
+	if (!ln->startup_time) {
+		usteer_update_time();
+		ln->startup_time = current_time - ln->registered;
+	}
+
+	MSG(INFO, "Connecting to local node %s (startup %u ms)\n",
+	    usteer_node_name(&ln->node), ln->startup_time);
 	ubus_subscribe(ubus_ctx, &ln->ev, ln->obj_id);
 	uloop_timeout_set(&ln->update, 1);
 	usteer_node_run_update_script(&ln->node);
@@ -737,19 +1057,25 @@ usteer_register_node(struct ubus_context *ctx, const char *name, uint32_t id)
 
 	MSG(INFO, "Creating local node %s\n", name);
 	ln = usteer_get_node(ctx, name);
+	usteer_local_node_state_reset(ln);
 	ln->obj_id = id;
 	ln->iface = usteer_node_name(&ln->node) + offset;
 	ln->ifindex = if_nametoindex(ln->iface);
 
+	usteer_update_time();
+	ln->registered = current_time;
+	ln->startup_time = 0;
+
+	/* Nodes register concurrently, the node is enabled once both complete */
 	blob_buf_init(&b, 0);
 	blobmsg_add_u32(&b, "notify_response", 1);
-	ubus_invoke(ctx, id, "notify_response", b.head, NULL, NULL, 1000);
+	usteer_local_node_req_start(ln, REQ_NOTIFY_RESPONSE, "notify_response", NULL);
 
 	blob_buf_init(&b, 0);
 	blobmsg_add_u8(&b, "neighbor_report", 1);
 	blobmsg_add_u8(&b, "beacon_report", 1);
 	blobmsg_add_u8(&b, "bss_transition", 1);
-	ubus_invoke(ctx, id, "bss_mgmt_enable", b.head, NULL, NULL, 1000);
+	usteer_local_node_req_start(ln, REQ_BSS_MGMT_ENABLE, "bss_mgmt_enable", NULL);
 
 	list_for_each_entry(h, &node_handlers, list) {
 		if (!h->init_node)
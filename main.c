@@ -30,6 +30,7 @@
 struct ubus_context *ubus_ctx;
 struct usteer_config config = {};
 struct blob_attr *host_info_blob;
+uint32_t host_info_version;
 uint64_t current_time;
 static int dump_time;
 
@@ -61,6 +62,76 @@ usteer_load_hex(char *hexstr, char *output, int output_size)
 	return i;
 }
 
+static int
+usteer_hex_val(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Parse a MAC address in xx:xx:xx:xx:xx:xx notation */
+bool
+usteer_parse_mac(const char *str, uint8_t *addr)
+{
+	int hi, lo;
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		/* Don't read past the terminator of truncated input */
+		hi = usteer_hex_val(str[0]);
+		if (hi < 0)
+			return false;
+
+		lo = usteer_hex_val(str[1]);
+		if (lo < 0)
+			return false;
+
+		addr[i] = (hi << 4) | lo;
+		str += 2;
+
+		if (i < 5 && *(str++) != ':')
+			return false;
+	}
+
+	return !*str;
+}
+
+void usteer_latency_hist_add(struct usteer_latency_hist *hist, uint32_t val)
+{
+	int i = 0;
+
+	while (i < USTEER_LATENCY_BUCKETS - 1 && val >= (1U << i))
+		i++;
+
+	hist->buckets[i]++;
+	hist->count++;
+}
+
+/* Returns the upper bound of the bucket holding the given percentile */
+uint32_t usteer_latency_hist_percentile(struct usteer_latency_hist *hist, int pct)
+{
+	uint64_t target, sum = 0;
+	int i;
+
+	if (!hist->count)
+		return 0;
+
+	target = DIV_ROUND_UP((uint64_t) hist->count * pct, 100);
+	for (i = 0; i < USTEER_LATENCY_BUCKETS - 1; i++) {
+		sum += hist->buckets[i];
+		if (sum >= target)
+			break;
+	}
+
+	return 1U << i;
+}
+
 void
 usteer_dump_hex(char *buf, size_t buf_size, char *output)
 {
@@ -122,7 +193,9 @@ void usteer_init_defaults(void)
 	config.local_sta_timeout = 120 * 1000;
 	config.measurement_report_timeout = 120 * 1000;
 	config.measurement_policy_timeout = 120 * 1000;
+	config.signal_smoothing = false;
 	config.local_sta_update = 1 * 1000;
+	config.local_sta_reconcile_interval = 30 * 1000;
 	config.max_retry_band = 5;
 	config.max_neighbor_reports = 8;
 	config.seen_policy_timeout = 30 * 1000;
@@ -131,6 +204,8 @@ void usteer_init_defaults(void)
 	config.remote_update_interval = 1000;
 	config.initial_connect_delay = 0;
 	config.remote_node_timeout = 10;
+	config.remote_timeout = 10 * 1000;
+	config.remote_full_update_interval = 0;
 
 	config.roam_kick_delay = 100;
 	config.roam_process_timeout = 5 * 1000;
@@ -138,6 +213,7 @@ void usteer_init_defaults(void)
 	config.roam_scan_timeout = 0;
 	config.roam_scan_interval = 10 * 1000;
 	config.roam_trigger_interval = 60 * 1000;
+	config.roam_predict_horizon = 0;
 
 	config.min_snr_kick_delay = 5 * 1000;
 
@@ -17,9 +17,25 @@
 
 #include "usteer.h"
 
-LIST_HEAD(measurements);
+static int usteer_measurement_cmp(const void *k1, const void *k2, void *ptr);
+
+static AVL_TREE(measurements, usteer_measurement_cmp, false, NULL);
 static struct usteer_timeout_queue tq;
 
+static int
+usteer_measurement_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const struct usteer_measurement_report *mr1 = k1, *mr2 = k2;
+
+	if (mr1->sta != mr2->sta)
+		return mr1->sta < mr2->sta ? -1 : 1;
+
+	if (mr1->node != mr2->node)
+		return mr1->node < mr2->node ? -1 : 1;
+
+	return 0;
+}
+
 void
 usteer_measurement_report_node_cleanup(struct usteer_node *node)
 {
@@ -41,15 +57,15 @@ usteer_measurement_report_sta_cleanup(struct sta *sta)
 struct usteer_measurement_report *
 usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool create)
 {
+	struct usteer_measurement_report key = {
+		.sta = sta,
+		.node = node,
+	};
 	struct usteer_measurement_report *mr;
 
-	list_for_each_entry(mr, &sta->measurements, sta_list) {
-		if (mr->node == node)
-			return mr;
-	}
-
-	if (!create)
-		return NULL;
+	mr = avl_find_element(&measurements, &key, mr, avl);
+	if (mr || !create)
+		return mr;
 
 	mr = calloc(1, sizeof(*mr));
 	if (!mr)
@@ -59,12 +75,12 @@ usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool cr
 	mr->node = node;
 	list_add(&mr->node_list, &node->measurements);
 	
-	/* Set sta & add to STAs list */
+	/* Set sta & add to STAs list, without timestamp it is the oldest */
 	mr->sta = sta;
-	list_add(&mr->sta_list, &sta->measurements);
+	list_add_tail(&mr->sta_list, &sta->measurements);
 
-	/* Add to Measurement list */
-	list_add(&mr->list, &measurements);
+	mr->avl.key = mr;
+	avl_insert(&measurements, &mr->avl);
 
 	/* Set measurement expiration */
 	usteer_timeout_set(&tq, &mr->timeout, config.measurement_report_timeout);
@@ -72,6 +88,23 @@ usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool cr
 	return mr;
 }
 
+/* Keep the per-STA list sorted, reports mostly arrive with the current time */
+static void
+usteer_measurement_report_sort(struct usteer_measurement_report *mr)
+{
+	struct usteer_measurement_report *cur;
+	struct list_head *pos = &mr->sta->measurements;
+
+	list_del(&mr->sta_list);
+	list_for_each_entry(cur, &mr->sta->measurements, sta_list) {
+		if (cur->timestamp <= mr->timestamp)
+			break;
+
+		pos = &cur->sta_list;
+	}
+	list_add(&mr->sta_list, pos);
+}
+
 struct usteer_measurement_report *
 usteer_measurement_report_add_beacon_report(struct sta *sta, struct usteer_node *node,
 					    struct usteer_beacon_report *br, uint64_t timestamp)
@@ -83,17 +116,31 @@ usteer_measurement_report_add_beacon_report(struct sta *sta, struct usteer_node
 
 	mr->timestamp = timestamp;
 	memcpy(&mr->beacon_report, br, sizeof(*br));
+	usteer_signal_history_add(&mr->signal, timestamp, usteer_rcpi_to_rssi(br->rcpi));
+	usteer_measurement_report_sort(mr);
+	usteer_sta_btm_invalidate(sta);
 
 	return mr;
 }
 
+/* Signal used for policy decisions */
+int
+usteer_measurement_report_signal(struct usteer_measurement_report *mr)
+{
+	if (config.signal_smoothing && mr->signal.n)
+		return usteer_signal_history_mean(&mr->signal);
+
+	return usteer_rcpi_to_rssi(mr->beacon_report.rcpi);
+}
+
 void
 usteer_measurement_report_del(struct usteer_measurement_report *mr)
 {
+	usteer_sta_btm_invalidate(mr->sta);
 	usteer_timeout_cancel(&tq, &mr->timeout);
 	list_del(&mr->node_list);
 	list_del(&mr->sta_list);
-	list_del(&mr->list);
+	avl_delete(&measurements, &mr->avl);
 	free(mr);
 }
 
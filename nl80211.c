@@ -36,24 +36,347 @@
 #include "usteer.h"
 #include "node.h"
 
+#define NL80211_REQ_TIMEOUT	5000
+#define NL80211_SCAN_TIMEOUT	15000
+#define NL80211_SURVEY_INTERVAL	1000
+#define NL80211_SURVEY_HISTORY	16
+#define NL80211_LOAD_EWMA_ALPHA	USTEER_EWMA_ALPHA(15)
+#define NL80211_CAPS_RETRY	10000
+
 static struct unl unl;
 static struct nlattr *tb[NL80211_ATTR_MAX + 1];
 
+/* Request on the asynchronous socket, must be the first member of its container */
+struct nl80211_req {
+	struct list_head list;
+	struct uloop_timeout timeout;
+	struct usteer_node *node;
+	uint32_t seq;
+
+	/* Called for every reply message, with the request as argument */
+	int (*cb)(struct nl_msg *msg, void *arg);
+	/* Called once the request completed, failed, timed out or was cancelled */
+	void (*done)(struct nl80211_req *req, int error);
+};
+
+static struct {
+	struct nl_sock *sock;
+	struct nl_cb *cb;
+	struct uloop_fd fd;
+} nl_async;
+
+static LIST_HEAD(nl80211_requests);
+static LIST_HEAD(nl80211_scans);
+static LIST_HEAD(nl80211_wiphys);
+
+/* Channel survey state of one frequency, shared by all nodes on the wiphy */
+struct nl80211_survey_freq {
+	struct list_head list;
+	uint16_t freq;
+	int8_t noise;
+
+	uint64_t time, time_busy;
+	struct usteer_ewma load;
+
+	/* Busy percentage of the last samples */
+	uint8_t busy[NL80211_SURVEY_HISTORY];
+	uint8_t busy_idx;
+	uint8_t n_busy;
+};
+
+struct nl80211_wiphy {
+	struct list_head list;
+	struct list_head freqs;
+	struct uloop_timeout update;
+	int id;
+	int refcount;
+	bool survey_pending;
+
+	/* Capability cache, refreshed on regulatory and radar events */
+	struct uloop_timeout caps_update;
+	struct usteer_freq_data *freqlist;
+	int n_freqlist;
+	bool caps_pending;
+};
+
 struct nl80211_survey_req {
-	void (*cb)(void *priv, struct usteer_survey_data *d);
-	void *priv;
+	struct nl80211_req req;
+	struct nl80211_wiphy *wiphy;
 };
 
 struct nl80211_scan_req {
+	struct nl80211_req req;
+	struct list_head list;
+	struct uloop_timeout timeout;
+	struct usteer_local_node *ln;
+	bool triggered;
+	bool ready;
+
 	void (*cb)(void *priv, struct usteer_scan_result *r);
 	void *priv;
 };
 
-struct nl80211_freqlist_req {
-	void (*cb)(void *priv, struct usteer_freq_data *f);
-	void *priv;
+struct nl80211_caps_req {
+	struct nl80211_req req;
+	struct nl80211_wiphy *wiphy;
+	struct usteer_freq_data *freqlist;
+	int n_freqlist;
 };
 
+static void nl80211_event(struct nl_msg *msg);
+static void nl80211_wiphy_caps_update(struct uloop_timeout *t);
+static void nl80211_wiphy_caps_invalidate(int id);
+static void nl80211_update_cqm(struct usteer_local_node *ln);
+static void nl80211_scan_free(struct nl80211_scan_req *req);
+static void nl80211_free_node(struct usteer_node *node);
+
+static void nl80211_req_free(struct nl80211_req *req, int error)
+{
+	free(req);
+}
+
+static void nl80211_req_complete(struct nl80211_req *req, int error)
+{
+	list_del(&req->list);
+	uloop_timeout_cancel(&req->timeout);
+	req->done(req, error);
+}
+
+static void nl80211_req_timeout(struct uloop_timeout *t)
+{
+	struct nl80211_req *req = container_of(t, struct nl80211_req, timeout);
+
+	MSG(DEBUG, "nl80211 request %u timed out\n", req->seq);
+	nl80211_req_complete(req, -ETIMEDOUT);
+}
+
+static struct nl80211_req *nl80211_req_find(uint32_t seq)
+{
+	struct nl80211_req *req;
+
+	list_for_each_entry(req, &nl80211_requests, list)
+		if (req->seq == seq)
+			return req;
+
+	return NULL;
+}
+
+static bool nl80211_req_pending(struct usteer_node *node,
+				int (*cb)(struct nl_msg *msg, void *arg))
+{
+	struct nl80211_req *req;
+
+	list_for_each_entry(req, &nl80211_requests, list)
+		if (req->node == node && req->cb == cb)
+			return true;
+
+	return false;
+}
+
+static void nl80211_req_cancel(struct usteer_node *node)
+{
+	struct nl80211_req *req, *tmp;
+
+	list_for_each_entry_safe(req, tmp, &nl80211_requests, list)
+		if (req->node == node)
+			nl80211_req_complete(req, -ECANCELED);
+}
+
+static int nl80211_async_valid(struct nl_msg *msg, void *arg)
+{
+	struct nl80211_req *req;
+	uint32_t seq = nlmsg_hdr(msg)->nlmsg_seq;
+
+	/* Multicast events are not tied to a request */
+	if (!seq) {
+		nl80211_event(msg);
+		return NL_SKIP;
+	}
+
+	req = nl80211_req_find(seq);
+	if (req && req->cb)
+		req->cb(msg, req);
+
+	return NL_SKIP;
+}
+
+static int nl80211_async_finish(struct nl_msg *msg, void *arg)
+{
+	struct nl80211_req *req = nl80211_req_find(nlmsg_hdr(msg)->nlmsg_seq);
+
+	if (req)
+		nl80211_req_complete(req, 0);
+
+	return NL_SKIP;
+}
+
+static int nl80211_async_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	struct nl80211_req *req = nl80211_req_find(err->msg.nlmsg_seq);
+
+	if (req)
+		nl80211_req_complete(req, err->error);
+
+	return NL_SKIP;
+}
+
+static int nl80211_async_no_seq_check(struct nl_msg *msg, void *arg)
+{
+	return NL_OK;
+}
+
+static void nl80211_async_fd_cb(struct uloop_fd *fd, unsigned int events)
+{
+	nl_recvmsgs(nl_async.sock, nl_async.cb);
+}
+
+static int nl80211_async_init(void)
+{
+	int id;
+
+	nl_async.sock = nl_socket_alloc();
+	if (!nl_async.sock)
+		return -1;
+
+	if (genl_connect(nl_async.sock) < 0)
+		goto error;
+
+	nl_async.cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!nl_async.cb)
+		goto error;
+
+	/* Several requests may be in flight, replies are matched in the callbacks */
+	nl_cb_set(nl_async.cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, nl80211_async_no_seq_check, NULL);
+	nl_cb_set(nl_async.cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_async_valid, NULL);
+	nl_cb_set(nl_async.cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_async_finish, NULL);
+	nl_cb_set(nl_async.cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_async_finish, NULL);
+	nl_cb_err(nl_async.cb, NL_CB_CUSTOM, nl80211_async_error, NULL);
+
+	id = unl_genl_multicast_id(&unl, "scan");
+	if (id >= 0)
+		nl_socket_add_membership(nl_async.sock, id);
+
+	id = unl_genl_multicast_id(&unl, "mlme");
+	if (id >= 0)
+		nl_socket_add_membership(nl_async.sock, id);
+
+	id = unl_genl_multicast_id(&unl, "regulatory");
+	if (id >= 0)
+		nl_socket_add_membership(nl_async.sock, id);
+
+	nl_socket_set_nonblocking(nl_async.sock);
+	nl_async.fd.fd = nl_socket_get_fd(nl_async.sock);
+	nl_async.fd.cb = nl80211_async_fd_cb;
+	uloop_fd_add(&nl_async.fd, ULOOP_READ);
+
+	return 0;
+
+error:
+	if (nl_async.cb)
+		nl_cb_put(nl_async.cb);
+	nl_socket_free(nl_async.sock);
+	nl_async.sock = NULL;
+	nl_async.cb = NULL;
+	return -1;
+}
+
+/* Send msg without waiting for the reply. On failure, req is left to the caller */
+static int nl80211_request(struct nl80211_req *req, struct usteer_node *node,
+			   struct nl_msg *msg)
+{
+	int ret;
+
+	if (!nl_async.sock) {
+		nlmsg_free(msg);
+		return -ENOTCONN;
+	}
+
+	ret = nl_send_auto_complete(nl_async.sock, msg);
+	req->seq = nlmsg_hdr(msg)->nlmsg_seq;
+	nlmsg_free(msg);
+	if (ret < 0)
+		return ret;
+
+	req->node = node;
+	req->timeout.cb = nl80211_req_timeout;
+	uloop_timeout_set(&req->timeout, NL80211_REQ_TIMEOUT);
+	list_add_tail(&req->list, &nl80211_requests);
+
+	return 0;
+}
+
+static struct nl80211_survey_freq *
+nl80211_survey_freq_get(struct nl80211_wiphy *wiphy, uint16_t freq, bool create)
+{
+	struct nl80211_survey_freq *f;
+
+	list_for_each_entry(f, &wiphy->freqs, list)
+		if (f->freq == freq)
+			return f;
+
+	if (!create)
+		return NULL;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+
+	f->freq = freq;
+	list_add_tail(&f->list, &wiphy->freqs);
+
+	return f;
+}
+
+static void nl80211_survey_freq_update(struct nl80211_survey_freq *f,
+				       struct usteer_survey_data *d)
+{
+	uint64_t delta = 0, delta_busy = 0;
+	uint8_t cur;
+
+	if (d->noise)
+		f->noise = d->noise;
+
+	/* Counters are reset on channel changes on some drivers */
+	if (f->time && d->time >= f->time && d->time_busy >= f->time_busy) {
+		delta = d->time - f->time;
+		delta_busy = d->time_busy - f->time_busy;
+	}
+
+	f->time = d->time;
+	f->time_busy = d->time_busy;
+
+	if (!delta)
+		return;
+
+	cur = (100 * delta_busy) / delta;
+	if (cur > 100)
+		cur = 100;
+
+	usteer_ewma_add(&f->load, cur, NL80211_LOAD_EWMA_ALPHA);
+
+	f->busy[f->busy_idx] = cur;
+	f->busy_idx = (f->busy_idx + 1) % NL80211_SURVEY_HISTORY;
+	if (f->n_busy < NL80211_SURVEY_HISTORY)
+		f->n_busy++;
+}
+
+static void nl80211_survey_freq_data(struct nl80211_survey_freq *f,
+				     struct usteer_survey_data *d)
+{
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	d->freq = f->freq;
+	d->noise = f->noise;
+	d->time = f->time;
+	d->time_busy = f->time_busy;
+	d->load = usteer_ewma_get(&f->load);
+
+	for (i = 0; i < f->n_busy; i++)
+		if (f->busy[i] > d->load_peak)
+			d->load_peak = f->busy[i];
+}
+
 static int nl80211_survey_result(struct nl_msg *msg, void *arg)
 {
 	static struct nla_policy survey_policy[NL80211_SURVEY_INFO_MAX + 1] = {
@@ -66,6 +389,7 @@ static int nl80211_survey_result(struct nl_msg *msg, void *arg)
 	struct nlattr *tb_s[NL80211_SURVEY_INFO_MAX + 1];
 	struct nl80211_survey_req *req = arg;
 	struct usteer_survey_data data = {};
+	struct nl80211_survey_freq *f;
 	struct genlmsghdr *gnlh;
 
 	gnlh = nlmsg_data(nlmsg_hdr(msg));
@@ -93,60 +417,164 @@ static int nl80211_survey_result(struct nl_msg *msg, void *arg)
 		data.time_busy = nla_get_u64(tb_s[NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY]);
 	}
 
-	req->cb(req->priv, &data);
+	f = nl80211_survey_freq_get(req->wiphy, data.freq, true);
+	if (f)
+		nl80211_survey_freq_update(f, &data);
 
 	return NL_SKIP;
 }
 
-static void nl80211_get_survey(struct usteer_node *node, void *priv,
-			       void (*cb)(void *priv, struct usteer_survey_data *d))
+/* Apply the survey of the operating channel to every node on the wiphy */
+static void nl80211_survey_done(struct nl80211_req *req, int error)
 {
-	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
-	struct nl80211_survey_req req = {
-		.priv = priv,
-		.cb = cb,
-	};
+	struct nl80211_survey_req *sreq = container_of(req, struct nl80211_survey_req, req);
+	struct nl80211_wiphy *wiphy = sreq->wiphy;
+	struct nl80211_survey_freq *f;
+	struct usteer_local_node *ln;
+	struct usteer_node *node;
+
+	wiphy->survey_pending = false;
+	free(sreq);
+
+	if (error)
+		return;
+
+	for_each_local_node(node) {
+		ln = container_of(node, struct usteer_local_node, node);
+		if (!ln->nl80211.present || ln->wiphy != wiphy->id)
+			continue;
+
+		f = nl80211_survey_freq_get(wiphy, node->freq, false);
+		if (!f)
+			continue;
+
+		if (f->noise)
+			node->noise = f->noise;
+
+		if (f->load.valid)
+			node->load = usteer_ewma_get(&f->load);
+	}
+}
+
+static struct usteer_local_node *nl80211_wiphy_node(struct nl80211_wiphy *wiphy)
+{
+	struct usteer_local_node *ln;
+	struct usteer_node *node;
+
+	for_each_local_node(node) {
+		ln = container_of(node, struct usteer_local_node, node);
+		if (ln->nl80211.present && ln->wiphy == wiphy->id && ln->ifindex)
+			return ln;
+	}
+
+	return NULL;
+}
+
+/* One survey dump per wiphy covers every channel, regardless of the number of BSSes */
+static void nl80211_wiphy_update(struct uloop_timeout *t)
+{
+	struct nl80211_wiphy *wiphy = container_of(t, struct nl80211_wiphy, update);
+	struct nl80211_survey_req *req;
+	struct usteer_local_node *ln;
 	struct nl_msg *msg;
 
-	if (!ln->nl80211.present)
+	uloop_timeout_set(t, NL80211_SURVEY_INTERVAL);
+
+	/* Don't pile up requests if the previous survey is still running */
+	if (wiphy->survey_pending)
+		return;
+
+	ln = nl80211_wiphy_node(wiphy);
+	if (!ln)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
 		return;
 
+	req->wiphy = wiphy;
+	req->req.cb = nl80211_survey_result;
+	req->req.done = nl80211_survey_done;
+
 	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SURVEY, true);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
-	unl_genl_request(&unl, msg, nl80211_survey_result, &req);
+	if (!nl80211_request(&req->req, &ln->node, msg)) {
+		wiphy->survey_pending = true;
+		return;
+	}
 
-nla_put_failure:
+	free(req);
 	return;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	free(req);
 }
 
-static void nl80211_update_node_result(void *priv, struct usteer_survey_data *d)
+static struct nl80211_wiphy *nl80211_wiphy_get(int id, bool create)
 {
-	struct usteer_local_node *ln = priv;
-	uint32_t delta = 0, delta_busy = 0;
+	struct nl80211_wiphy *wiphy;
 
-	if (d->freq != ln->node.freq)
-		return;
+	list_for_each_entry(wiphy, &nl80211_wiphys, list)
+		if (wiphy->id == id)
+			return wiphy;
 
-	if (d->noise)
-		ln->node.noise = d->noise;
+	if (!create)
+		return NULL;
 
-	if (ln->time) {
-		delta = d->time - ln->time;
-		delta_busy = d->time_busy - ln->time_busy;
+	wiphy = calloc(1, sizeof(*wiphy));
+	if (!wiphy)
+		return NULL;
+
+	wiphy->id = id;
+	INIT_LIST_HEAD(&wiphy->freqs);
+	wiphy->update.cb = nl80211_wiphy_update;
+	uloop_timeout_set(&wiphy->update, 1);
+	wiphy->caps_update.cb = nl80211_wiphy_caps_update;
+	uloop_timeout_set(&wiphy->caps_update, 1);
+	list_add_tail(&wiphy->list, &nl80211_wiphys);
+
+	return wiphy;
+}
+
+static void nl80211_wiphy_put(int id)
+{
+	struct nl80211_wiphy *wiphy = nl80211_wiphy_get(id, false);
+	struct nl80211_survey_freq *f, *tmp;
+
+	if (!wiphy || --wiphy->refcount > 0)
+		return;
+
+	uloop_timeout_cancel(&wiphy->update);
+	uloop_timeout_cancel(&wiphy->caps_update);
+	list_for_each_entry_safe(f, tmp, &wiphy->freqs, list) {
+		list_del(&f->list);
+		free(f);
 	}
+	free(wiphy->freqlist);
+	list_del(&wiphy->list);
+	free(wiphy);
+}
 
-	ln->time = d->time;
-	ln->time_busy = d->time_busy;
+/* Served from the shared survey cache */
+static void nl80211_get_survey(struct usteer_node *node, void *priv,
+			       void (*cb)(void *priv, struct usteer_survey_data *d))
+{
+	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+	struct usteer_survey_data data;
+	struct nl80211_survey_freq *f;
+	struct nl80211_wiphy *wiphy;
 
-	if (delta) {
-		float cur = (100 * delta_busy) / delta;
+	if (!ln->nl80211.present)
+		return;
 
-		if (ln->load_ewma < 0)
-			ln->load_ewma = cur;
-		else
-			ln->load_ewma = 0.85 * ln->load_ewma + 0.15 * cur;
+	wiphy = nl80211_wiphy_get(ln->wiphy, false);
+	if (!wiphy)
+		return;
 
-		ln->node.load = ln->load_ewma;
+	list_for_each_entry(f, &wiphy->freqs, list) {
+		nl80211_survey_freq_data(f, &data);
+		cb(priv, &data);
 	}
 }
 
@@ -156,12 +584,13 @@ static void nl80211_update_node(struct uloop_timeout *t)
 
 	uloop_timeout_set(t, 1000);
 	ln->ifindex = if_nametoindex(ln->iface);
-	nl80211_get_survey(&ln->node, ln, nl80211_update_node_result);
+	nl80211_update_cqm(ln);
 }
 
 static void nl80211_init_node(struct usteer_node *node)
 {
 	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+	struct nl80211_wiphy *wiphy;
 	struct genlmsghdr *gnlh;
 	static bool _init = false;
 	struct nl_msg *msg;
@@ -169,7 +598,13 @@ static void nl80211_init_node(struct usteer_node *node)
 	if (node->type != NODE_TYPE_LOCAL)
 		return;
 
+	/* Re-registered hostapd object, drop the wiphy reference of the old one */
+	if (ln->nl80211.present)
+		nl80211_free_node(node);
+
 	ln->nl80211.present = false;
+	ln->nl80211.cqm_thold = 0;
+	ln->nl80211.cqm_failed = false;
 	ln->wiphy = -1;
 
 	if (!ln->ifindex) {
@@ -184,6 +619,9 @@ static void nl80211_init_node(struct usteer_node *node)
 			return;
 		}
 
+		if (nl80211_async_init() < 0)
+			MSG(INFO, "nl80211 async socket init failed\n");
+
 		_init = true;
 	}
 
@@ -218,7 +656,11 @@ static void nl80211_init_node(struct usteer_node *node)
 	}
 
 	MSG(INFO, "Found nl80211 phy on wdev %s, ssid=%s\n", usteer_node_name(node), node->ssid);
-	ln->load_ewma = -1;
+	wiphy = nl80211_wiphy_get(ln->wiphy, true);
+	if (!wiphy)
+		goto nla_put_failure;
+
+	wiphy->refcount++;
 	ln->nl80211.present = true;
 	ln->nl80211.update.cb = nl80211_update_node;
 	nl80211_update_node(&ln->nl80211.update);
@@ -236,55 +678,54 @@ static void nl80211_free_node(struct usteer_node *node)
 		return;
 
 	uloop_timeout_cancel(&ln->nl80211.update);
+	nl80211_req_cancel(node);
+	if (ln->nl80211.scan)
+		nl80211_scan_free(ln->nl80211.scan);
+	nl80211_wiphy_put(ln->wiphy);
+	ln->nl80211.present = false;
 }
 
 static void nl80211_update_sta_airtime(struct sta_info *si, uint64_t rx_airtime, uint64_t tx_airtime)
 {
 	uint64_t total_airtime = rx_airtime + tx_airtime;
-	uint64_t airtime_delta = (rx_airtime + tx_airtime) - si->airtime.last_total;
-	float load;
-
-	if (si->airtime.last_total) {
-		if (!si->airtime.load_weight) {
-			load = airtime_delta;
-		} else {
-			load = (0.85 * si->airtime.load_weight) + (0.15 * airtime_delta);
-		}
-		si->airtime.load_weight = load;
-	}
+	uint64_t airtime_delta = total_airtime - si->airtime.last_total;
+
+	if (si->airtime.last_total && total_airtime >= si->airtime.last_total)
+		usteer_ewma_add(&si->airtime.load, airtime_delta, NL80211_LOAD_EWMA_ALPHA);
 
 	si->airtime.last_total = total_airtime;
 }
 
-static void nl80211_update_sta(struct usteer_node *node, struct sta_info *si)
+static int nl80211_update_stations_result(struct nl_msg *msg, void *arg)
 {
 	struct nlattr *tb_sta[NL80211_STA_INFO_MAX + 1];
-	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nl80211_req *req = arg;
+	struct usteer_node *node = req->node;
 	struct genlmsghdr *gnlh;
-	struct nl_msg *msg;
+	struct sta_info *si;
+	struct sta *sta;
 	int signal = NO_SIGNAL;
 	uint64_t rx_airtime = 0, tx_airtime = 0;
 
-	if (!ln->nl80211.present)
-		return;
-
-	msg = unl_genl_msg(&unl, NL80211_CMD_GET_STATION, false);
-	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
-	NLA_PUT(msg, NL80211_ATTR_MAC, ETH_ALEN, si->sta->addr);
-	unl_genl_request_single(&unl, msg, &msg);
-	if (!msg)
-		return;
-
 	gnlh = nlmsg_data(nlmsg_hdr(msg));
 	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
-	if (!tb[NL80211_ATTR_STA_INFO])
-		goto nla_put_failure;
+	if (!tb[NL80211_ATTR_MAC] || !tb[NL80211_ATTR_STA_INFO])
+		return NL_SKIP;
+
+	sta = usteer_sta_get(nla_data(tb[NL80211_ATTR_MAC]), false);
+	if (!sta)
+		return NL_SKIP;
+
+	si = usteer_sta_info_get(sta, node, NULL);
+	if (!si || si->connected != STA_CONNECTED)
+		return NL_SKIP;
 
 	if (nla_parse_nested(tb_sta, NL80211_STA_INFO_MAX,
 			     tb[NL80211_ATTR_STA_INFO], NULL))
-		goto nla_put_failure;
+		return NL_SKIP;
 
 	if (tb_sta[NL80211_STA_INFO_SIGNAL_AVG])
 		signal = (int8_t) nla_get_u8(tb_sta[NL80211_STA_INFO_SIGNAL_AVG]);
@@ -299,9 +740,40 @@ static void nl80211_update_sta(struct usteer_node *node, struct sta_info *si)
 
 	usteer_sta_info_update(si, signal, true);
 
+	return NL_SKIP;
+}
+
+/* Fetch the statistics of all stations on the interface with a single dump */
+static void nl80211_update_stations(struct usteer_node *node)
+{
+	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+	struct nl80211_req *req;
+	struct nl_msg *msg;
+
+	if (!ln->nl80211.present)
+		return;
+
+	if (nl80211_req_pending(node, nl80211_update_stations_result))
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return;
+
+	req->cb = nl80211_update_stations_result;
+	req->done = nl80211_req_free;
+
+	msg = unl_genl_msg(&unl, NL80211_CMD_GET_STATION, true);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
+	if (!nl80211_request(req, node, msg))
+		return;
+
+	free(req);
+	return;
+
 nla_put_failure:
 	nlmsg_free(msg);
-	return;
+	free(req);
 }
 
 static int nl80211_scan_result(struct nl_msg *msg, void *arg)
@@ -370,28 +842,254 @@ skip_ie:
 	return NL_SKIP;
 }
 
-static int nl80211_scan_event_cb(struct nl_msg *msg, void *data)
+static void nl80211_scan_free(struct nl80211_scan_req *req)
+{
+	uloop_timeout_cancel(&req->timeout);
+	list_del(&req->list);
+	req->ln->nl80211.scan = NULL;
+	free(req);
+}
+
+static void nl80211_scan_done(struct nl80211_req *r, int error)
+{
+	nl80211_scan_free(container_of(r, struct nl80211_scan_req, req));
+}
+
+static void nl80211_scan_fetch(struct nl80211_scan_req *req)
+{
+	struct nl_msg *msg;
+
+	uloop_timeout_cancel(&req->timeout);
+	if (!req->cb)
+		goto out;
+
+	req->req.cb = nl80211_scan_result;
+	req->req.done = nl80211_scan_done;
+
+	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SCAN, true);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, req->ln->ifindex);
+	if (!nl80211_request(&req->req, &req->ln->node, msg))
+		return;
+
+	goto out;
+
+nla_put_failure:
+	nlmsg_free(msg);
+out:
+	nl80211_scan_free(req);
+}
+
+static void nl80211_scan_timeout(struct uloop_timeout *t)
+{
+	struct nl80211_scan_req *req = container_of(t, struct nl80211_scan_req, timeout);
+
+	MSG(DEBUG, "Scan on %s timed out\n", usteer_node_name(&req->ln->node));
+	nl80211_scan_free(req);
+}
+
+static void nl80211_scan_trigger_done(struct nl80211_req *r, int error)
+{
+	struct nl80211_scan_req *req = container_of(r, struct nl80211_scan_req, req);
+
+	if (error) {
+		MSG(DEBUG, "Failed to trigger scan on %s: %d\n",
+		    usteer_node_name(&req->ln->node), error);
+		nl80211_scan_free(req);
+		return;
+	}
+
+	req->triggered = true;
+	if (req->ready) {
+		nl80211_scan_fetch(req);
+		return;
+	}
+
+	uloop_timeout_set(&req->timeout, NL80211_SCAN_TIMEOUT);
+}
+
+static void nl80211_scan_event(int ifindex)
+{
+	struct nl80211_scan_req *req;
+
+	list_for_each_entry(req, &nl80211_scans, list) {
+		if (req->ln->ifindex != ifindex)
+			continue;
+
+		/* The trigger request may not have been acknowledged yet */
+		if (req->triggered)
+			nl80211_scan_fetch(req);
+		else
+			req->ready = true;
+		return;
+	}
+}
+
+static struct usteer_local_node *nl80211_node_by_ifindex(int ifindex)
+{
+	struct usteer_local_node *ln;
+	struct usteer_node *node;
+
+	for_each_local_node(node) {
+		ln = container_of(node, struct usteer_local_node, node);
+		if (ln->nl80211.present && ln->ifindex == ifindex)
+			return ln;
+	}
+
+	return NULL;
+}
+
+static struct sta_info *nl80211_event_sta(struct usteer_local_node *ln, struct nlattr **tb)
+{
+	struct sta *sta;
+
+	if (!tb[NL80211_ATTR_MAC])
+		return NULL;
+
+	sta = usteer_sta_get(nla_data(tb[NL80211_ATTR_MAC]), false);
+	if (!sta)
+		return NULL;
+
+	return usteer_sta_info_get(sta, &ln->node, NULL);
+}
+
+/*
+ * Connection state is tracked through hostapd. A station the kernel removed
+ * while still considered connected means a notification was missed.
+ */
+static void nl80211_del_station_event(struct usteer_local_node *ln, struct nlattr **tb)
+{
+	struct sta_info *si = nl80211_event_sta(ln, tb);
+
+	if (!si || si->connected != STA_CONNECTED)
+		return;
+
+	MSG(DEBUG, "Station " MAC_ADDR_FMT " removed from %s, resyncing clients\n",
+	    MAC_ADDR_DATA(si->sta->addr), usteer_node_name(&ln->node));
+	ln->reconcile_pending = true;
+}
+
+static void nl80211_cqm_event(struct usteer_local_node *ln, struct nlattr **tb)
+{
+	struct nlattr *tb_cqm[NL80211_ATTR_CQM_MAX + 1];
+	struct sta_info *si;
+
+	if (!tb[NL80211_ATTR_CQM] ||
+	    nla_parse_nested(tb_cqm, NL80211_ATTR_CQM_MAX, tb[NL80211_ATTR_CQM], NULL))
+		return;
+
+	if (!tb_cqm[NL80211_ATTR_CQM_RSSI_LEVEL])
+		return;
+
+	si = nl80211_event_sta(ln, tb);
+	if (!si)
+		return;
+
+	usteer_update_time();
+	usteer_sta_info_update(si, (int32_t) nla_get_u32(tb_cqm[NL80211_ATTR_CQM_RSSI_LEVEL]), true);
+}
+
+static void nl80211_event(struct nl_msg *msg)
 {
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct usteer_local_node *ln;
+	int ifindex;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	switch (gnlh->cmd) {
+	case NL80211_CMD_REG_CHANGE:
+	case NL80211_CMD_WIPHY_REG_CHANGE:
+	case NL80211_CMD_RADAR_DETECT:
+		nl80211_wiphy_caps_invalidate(tb[NL80211_ATTR_WIPHY] ?
+					      nla_get_u32(tb[NL80211_ATTR_WIPHY]) : -1);
+		return;
+	}
+
+	if (!tb[NL80211_ATTR_IFINDEX])
+		return;
+
+	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
 
 	switch (gnlh->cmd) {
 	case NL80211_CMD_NEW_SCAN_RESULTS:
 	case NL80211_CMD_SCAN_ABORTED:
-		unl_loop_done(&unl);
+		nl80211_scan_event(ifindex);
+		return;
+	case NL80211_CMD_DEL_STATION:
+	case NL80211_CMD_NOTIFY_CQM:
 		break;
+	default:
+		return;
 	}
 
-	return NL_SKIP;
+	ln = nl80211_node_by_ifindex(ifindex);
+	if (!ln)
+		return;
+
+	if (gnlh->cmd == NL80211_CMD_DEL_STATION)
+		nl80211_del_station_event(ln, tb);
+	else
+		nl80211_cqm_event(ln, tb);
+}
+
+static void nl80211_cqm_done(struct nl80211_req *req, int error)
+{
+	struct usteer_local_node *ln;
+
+	if (error && error != -ECANCELED) {
+		ln = container_of(req->node, struct usteer_local_node, node);
+		MSG(DEBUG, "CQM not supported on %s (%d)\n",
+		    usteer_node_name(req->node), error);
+		ln->nl80211.cqm_failed = true;
+	}
+
+	free(req);
+}
+
+/* Ask the driver for notifications when a client crosses the policy threshold */
+static void nl80211_update_cqm(struct usteer_local_node *ln)
+{
+	int thold = usteer_policy_signal_threshold(&ln->node);
+	struct nl80211_req *req;
+	struct nlattr *cqm;
+	struct nl_msg *msg;
+
+	if (ln->nl80211.cqm_failed || thold == ln->nl80211.cqm_thold)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return;
+
+	req->done = nl80211_cqm_done;
+	ln->nl80211.cqm_thold = thold;
+
+	/* A zero threshold disables the notifications */
+	msg = unl_genl_msg(&unl, NL80211_CMD_SET_CQM, false);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
+	cqm = nla_nest_start(msg, NL80211_ATTR_CQM);
+	NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_THOLD, thold);
+	NLA_PUT_U32(msg, NL80211_ATTR_CQM_RSSI_HYST, 2);
+	nla_nest_end(msg, cqm);
+
+	if (!nl80211_request(req, &ln->node, msg))
+		return;
+
+	free(req);
+	return;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	free(req);
 }
 
 static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *req,
 			void *priv, void (*cb)(void *priv, struct usteer_scan_result *r))
 {
 	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
-	struct nl80211_scan_req reqdata = {
-		.priv = priv,
-		.cb = cb,
-	};
+	struct nl80211_scan_req *scan;
 	struct nl_msg *msg;
 	struct nlattr *cur;
 	int i, ret;
@@ -399,6 +1097,19 @@ static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *re
 	if (!ln->nl80211.present)
 		return -ENODEV;
 
+	if (ln->nl80211.scan)
+		return -EBUSY;
+
+	scan = calloc(1, sizeof(*scan));
+	if (!scan)
+		return -ENOMEM;
+
+	scan->ln = ln;
+	scan->priv = priv;
+	scan->cb = cb;
+	scan->timeout.cb = nl80211_scan_timeout;
+	scan->req.done = nl80211_scan_trigger_done;
+
 	msg = unl_genl_msg(&unl, NL80211_CMD_TRIGGER_SCAN, false);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
 
@@ -417,35 +1128,44 @@ static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *re
 		nla_nest_end(msg, cur);
 	}
 
-	unl_genl_subscribe(&unl, "scan");
-	ret = unl_genl_request(&unl, msg, NULL, NULL);
-	if (ret < 0)
-		goto done;
-
-	unl_genl_loop(&unl, nl80211_scan_event_cb, NULL);
-
-done:
-	unl_genl_unsubscribe(&unl, "scan");
-	if (ret < 0)
+	ret = nl80211_request(&scan->req, node, msg);
+	if (ret < 0) {
+		free(scan);
 		return ret;
+	}
 
-	if (!cb)
-		return 0;
-
-	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SCAN, true);
-	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
-	unl_genl_request(&unl, msg, nl80211_scan_result, &reqdata);
+	list_add_tail(&scan->list, &nl80211_scans);
+	ln->nl80211.scan = scan;
 
 	return 0;
 
 nla_put_failure:
 	nlmsg_free(msg);
+	free(scan);
 	return -ENOMEM;
 }
 
+static void nl80211_caps_add_freq(struct nl80211_caps_req *req, struct usteer_freq_data *f)
+{
+	struct usteer_freq_data *freqlist;
+	int i;
+
+	/* Split dumps may repeat a band across messages */
+	for (i = 0; i < req->n_freqlist; i++)
+		if (req->freqlist[i].freq == f->freq)
+			return;
+
+	freqlist = realloc(req->freqlist, (req->n_freqlist + 1) * sizeof(*freqlist));
+	if (!freqlist)
+		return;
+
+	freqlist[req->n_freqlist++] = *f;
+	req->freqlist = freqlist;
+}
+
 static int nl80211_wiphy_result(struct nl_msg *msg, void *arg)
 {
-	struct nl80211_freqlist_req *req = arg;
+	struct nl80211_caps_req *req = arg;
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
 	struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
@@ -490,47 +1210,128 @@ static int nl80211_wiphy_result(struct nl_msg *msg, void *arg)
 			f.freq = nla_get_u32(cur);
 			f.dfs = !!tb_freq[NL80211_FREQUENCY_ATTR_RADAR];
 
+			cur = tb_freq[NL80211_FREQUENCY_ATTR_DFS_STATE];
+			if (cur)
+				f.unavailable = nla_get_u32(cur) == NL80211_DFS_UNAVAILABLE;
+
 			cur = tb_freq[NL80211_FREQUENCY_ATTR_MAX_TX_POWER];
 			if (cur)
 				f.txpower = nla_get_u32(cur) / 100;
 
-			req->cb(req->priv, &f);
+			nl80211_caps_add_freq(req, &f);
 		}
 	}
 
 	return NL_SKIP;
 }
 
-static void nl80211_get_freqlist(struct usteer_node *node, void *priv,
-				 void (*cb)(void *priv, struct usteer_freq_data *f))
+static void nl80211_wiphy_caps_done(struct nl80211_req *req, int error)
 {
-	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
-	struct nl80211_freqlist_req req = {
-		.priv = priv,
-		.cb = cb
-	};
+	struct nl80211_caps_req *creq = container_of(req, struct nl80211_caps_req, req);
+	struct nl80211_wiphy *wiphy = creq->wiphy;
+
+	wiphy->caps_pending = false;
+
+	if (error || !creq->n_freqlist) {
+		if (error != -ECANCELED)
+			MSG(DEBUG, "Failed to fetch capabilities of phy%d (%d)\n", wiphy->id, error);
+		uloop_timeout_set(&wiphy->caps_update, NL80211_CAPS_RETRY);
+		free(creq->freqlist);
+		free(creq);
+		return;
+	}
+
+	free(wiphy->freqlist);
+	wiphy->freqlist = creq->freqlist;
+	wiphy->n_freqlist = creq->n_freqlist;
+	free(creq);
+
+	MSG(DEBUG, "Updated capabilities of phy%d, %d usable frequencies\n",
+	    wiphy->id, wiphy->n_freqlist);
+}
+
+static void nl80211_wiphy_caps_update(struct uloop_timeout *t)
+{
+	struct nl80211_wiphy *wiphy = container_of(t, struct nl80211_wiphy, caps_update);
+	struct nl80211_caps_req *req;
+	struct usteer_local_node *ln;
 	struct nl_msg *msg;
 
-	if (!ln->nl80211.present)
+	/* Pick up the latest state once the running request finished */
+	if (wiphy->caps_pending) {
+		uloop_timeout_set(t, 100);
 		return;
+	}
 
-	msg = unl_genl_msg(&unl, NL80211_CMD_GET_WIPHY, false);
+	ln = nl80211_wiphy_node(wiphy);
+	if (!ln) {
+		uloop_timeout_set(t, NL80211_CAPS_RETRY);
+		return;
+	}
 
-	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY, ln->wiphy);
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return;
+
+	req->wiphy = wiphy;
+	req->req.cb = nl80211_wiphy_result;
+	req->req.done = nl80211_wiphy_caps_done;
+
+	msg = unl_genl_msg(&unl, NL80211_CMD_GET_WIPHY, true);
+	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY, wiphy->id);
 	NLA_PUT_FLAG(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP);
 
-	unl_genl_request(&unl, msg, nl80211_wiphy_result, &req);
+	if (!nl80211_request(&req->req, &ln->node, msg)) {
+		wiphy->caps_pending = true;
+		return;
+	}
 
+	free(req);
+	uloop_timeout_set(t, NL80211_CAPS_RETRY);
 	return;
 
 nla_put_failure:
 	nlmsg_free(msg);
+	free(req);
+}
+
+/* id < 0 invalidates all radios, e.g. on a global regulatory change */
+static void nl80211_wiphy_caps_invalidate(int id)
+{
+	struct nl80211_wiphy *wiphy;
+
+	list_for_each_entry(wiphy, &nl80211_wiphys, list) {
+		if (id >= 0 && wiphy->id != id)
+			continue;
+
+		/* Radar events come in bursts */
+		uloop_timeout_set(&wiphy->caps_update, 100);
+	}
+}
+
+/* Served from the capability cache */
+static void nl80211_get_freqlist(struct usteer_node *node, void *priv,
+				 void (*cb)(void *priv, struct usteer_freq_data *f))
+{
+	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
+	struct nl80211_wiphy *wiphy;
+	int i;
+
+	if (!ln->nl80211.present)
+		return;
+
+	wiphy = nl80211_wiphy_get(ln->wiphy, false);
+	if (!wiphy)
+		return;
+
+	for (i = 0; i < wiphy->n_freqlist; i++)
+		cb(priv, &wiphy->freqlist[i]);
 }
 
 static struct usteer_node_handler nl80211_handler = {
 	.init_node = nl80211_init_node,
 	.free_node = nl80211_free_node,
-	.update_sta = nl80211_update_sta,
+	.update_stations = nl80211_update_stations,
 	.get_survey = nl80211_get_survey,
 	.get_freqlist = nl80211_get_freqlist,
 	.scan = nl80211_scan,
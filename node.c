@@ -46,22 +46,123 @@ struct usteer_node *usteer_node_by_bssid(uint8_t *bssid) {
 	return NULL;
 }
 
-void usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val)
+/*
+ * Returns true if the stored blob changed. Comparing the content directly is
+ * cheaper than hashing it: the memcmp stops at the first difference and the
+ * blobs have to be read in full either way.
+ */
+bool usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val)
 {
 	int new_len;
 	int len;
 
 	if (!val) {
+		if (!*dest)
+			return false;
+
 		free(*dest);
 		*dest = NULL;
-		return;
+		return true;
 	}
 
 	len = *dest ? blob_pad_len(*dest) : 0;
 	new_len = blob_pad_len(val);
+	if (new_len == len && !memcmp(*dest, val, len))
+		return false;
+
 	if (new_len != len)
 		*dest = realloc(*dest, new_len);
 	memcpy(*dest, val, new_len);
+
+	return true;
+}
+
+static struct blob_attr *
+usteer_node_blob_find_attr(struct blob_attr *data, const char *name)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	if (!data)
+		return NULL;
+
+	blob_for_each_attr(cur, data, rem)
+		if (!strcmp(blobmsg_name(cur), name))
+			return cur;
+
+	return NULL;
+}
+
+/*
+ * Replace the attribute old (NULL to append) inside the table *dest with
+ * val (NULL to remove it), moving only the data that follows it.
+ */
+static void
+usteer_node_blob_splice(struct blob_attr **dest, struct blob_attr *old,
+			struct blob_attr *val)
+{
+	struct blob_attr *data = *dest;
+	size_t len, ofs, old_len, new_len;
+
+	if (!data) {
+		data = calloc(1, sizeof(*data));
+		blob_set_raw_len(data, sizeof(*data));
+	}
+
+	len = blob_raw_len(data);
+	ofs = old ? (char *) old - (char *) data : len;
+	old_len = old ? blob_pad_len(old) : 0;
+	new_len = val ? blob_pad_len(val) : 0;
+
+	if (new_len > old_len)
+		data = realloc(data, len - old_len + new_len);
+
+	memmove((char *) data + ofs + new_len, (char *) data + ofs + old_len,
+		len - ofs - old_len);
+
+	if (val) {
+		memset((char *) data + ofs, 0, new_len);
+		memcpy((char *) data + ofs, val, blob_raw_len(val));
+	}
+
+	len = len - old_len + new_len;
+	blob_set_raw_len(data, len);
+	if (!blob_len(data)) {
+		free(data);
+		data = NULL;
+	} else if (new_len < old_len) {
+		data = realloc(data, len);
+	}
+
+	*dest = data;
+}
+
+/* Set a named blobmsg attribute in a table, returns true if it changed */
+bool usteer_node_blob_set_attr(struct blob_attr **dest, struct blob_attr *val)
+{
+	struct blob_attr *old;
+
+	old = usteer_node_blob_find_attr(*dest, blobmsg_name(val));
+	if (old && blob_raw_len(old) == blob_raw_len(val) &&
+	    !memcmp(old, val, blob_raw_len(val)))
+		return false;
+
+	usteer_node_blob_splice(dest, old, val);
+
+	return true;
+}
+
+bool usteer_node_blob_del_attr(struct blob_attr **dest, const char *name)
+{
+	struct blob_attr *old;
+
+	old = usteer_node_blob_find_attr(*dest, name);
+	if (!old)
+		return false;
+
+	usteer_node_blob_splice(dest, old, NULL);
+
+	return true;
 }
 
 static struct usteer_node *
@@ -20,14 +20,16 @@
 #ifndef __APMGR_NODE_H
 #define __APMGR_NODE_H
 
+#include <arpa/inet.h>
 #include "usteer.h"
 
-enum local_req_state {
-	REQ_IDLE,
+enum local_req_type {
 	REQ_CLIENTS,
 	REQ_STATUS,
 	REQ_RRM_SET_LIST,
 	REQ_RRM_GET_OWN,
+	REQ_NOTIFY_RESPONSE,
+	REQ_BSS_MGMT_ENABLE,
 	__REQ_MAX
 };
 
@@ -41,25 +43,62 @@ struct usteer_local_node {
 	int ifindex;
 	int wiphy;
 
-	struct ubus_request req;
-	struct uloop_timeout req_timer;
-	int req_state;
+	struct {
+		struct ubus_request req;
+		bool pending;
+	} req[__REQ_MAX];
+
+	uint64_t last_reconcile;
+	bool reconcile_pending;
+
+	int status_freq;
+	bool status_valid;
+	bool rrm_own_valid;
+	struct blob_attr *rrm_nr_set;
 
 	uint32_t obj_id;
 
-	float load_ewma;
-	int load_thr_count;
+	uint64_t registered;
+	uint32_t startup_time;
 
-	uint64_t time, time_busy;
+	/* A connected client may be below a roam or kick threshold */
+	bool signal_check;
 
-	struct kvlist node_info;
+	int load_thr_count;
 
 	struct uloop_timeout bss_tm_queries_timeout;
 	struct list_head bss_tm_queries;
 
+	struct {
+		uint32_t queries;
+		uint32_t cache_hits;
+		struct usteer_latency_hist latency;
+	} bss_tm;
+
+	/* Station ranges requested by peers for resync */
+	uint16_t resync_ranges;
+
+	/* Asynchronous hostapd commands */
+	struct {
+		struct list_head queue;
+		struct list_head pending;
+		int n_queued;
+		int n_pending;
+
+		uint32_t max_queued;
+		uint32_t completed;
+		uint32_t failed;
+		uint32_t dropped;
+		uint64_t latency_total;
+		uint32_t latency_max;
+	} cmd;
+
 	struct {
 		bool present;
 		struct uloop_timeout update;
+		struct nl80211_scan_req *scan;
+		int cqm_thold;
+		bool cqm_failed;
 	} nl80211;
 	struct {
 		struct ubus_request req;
@@ -75,7 +114,11 @@ struct usteer_remote_host {
 
 	struct list_head nodes;
 	struct blob_attr *host_info;
-	char *addr;
+	struct usteer_timeout timeout;
+
+	uint8_t addr_bin[sizeof(struct in6_addr)];
+	int addr_len;
+	char addr[INET6_ADDRSTRLEN];
 };
 
 struct usteer_remote_node {
@@ -86,7 +129,7 @@ struct usteer_remote_node {
 	struct usteer_remote_host *host;
 	struct usteer_node node;
 
-	int check;
+	struct usteer_timeout timeout;
 };
 
 extern struct avl_tree local_nodes;
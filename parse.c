@@ -17,6 +17,8 @@
  *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
  */
 
+#include <netinet/in.h>
+
 #include "usteer.h"
 #include "remote.h"
 
@@ -27,6 +29,8 @@ bool parse_apmsg(struct apmsg *msg, struct blob_attr *data)
 		[APMSG_SEQ] = { .type = BLOB_ATTR_INT32 },
 		[APMSG_NODES] = { .type = BLOB_ATTR_NESTED },
 		[APMSG_HOST_INFO] = { .type = BLOB_ATTR_NESTED },
+		[APMSG_HOST_ADDR] = { .type = BLOB_ATTR_BINARY },
+		[APMSG_RESYNC] = { .type = BLOB_ATTR_NESTED },
 	};
 	struct blob_attr *tb[__APMSG_MAX];
 
@@ -38,6 +42,15 @@ bool parse_apmsg(struct apmsg *msg, struct blob_attr *data)
 	msg->seq = blob_get_int32(tb[APMSG_SEQ]);
 	msg->nodes = tb[APMSG_NODES];
 	msg->host_info = tb[APMSG_HOST_INFO];
+	msg->host_addr = NULL;
+	msg->host_addr_len = 0;
+	if (tb[APMSG_HOST_ADDR] &&
+	    (blob_len(tb[APMSG_HOST_ADDR]) == sizeof(struct in_addr) ||
+	     blob_len(tb[APMSG_HOST_ADDR]) == sizeof(struct in6_addr))) {
+		msg->host_addr = blob_data(tb[APMSG_HOST_ADDR]);
+		msg->host_addr_len = blob_len(tb[APMSG_HOST_ADDR]);
+	}
+	msg->resync = tb[APMSG_RESYNC];
 
 	return true;
 }
@@ -66,6 +79,8 @@ bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
 		[APMSG_NODE_NODE_INFO] = { .type = BLOB_ATTR_NESTED },
 		[APMSG_NODE_CHANNEL] = { .type = BLOB_ATTR_INT32 },
 		[APMSG_NODE_OP_CLASS] = { .type = BLOB_ATTR_INT32 },
+		[APMSG_NODE_DIGEST] = { .type = BLOB_ATTR_BINARY },
+		[APMSG_NODE_RANGES] = { .type = BLOB_ATTR_INT32 },
 	};
 	struct blob_attr *tb[__APMSG_NODE_MAX];
 	struct blob_attr *cur;
@@ -120,6 +135,14 @@ bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
 
 	msg->node_info = tb[APMSG_NODE_NODE_INFO];
 
+	cur = tb[APMSG_NODE_DIGEST];
+	if (cur && blob_len(cur) == APMSG_STA_RANGES * sizeof(uint32_t))
+		msg->digest = blob_data(cur);
+	else
+		msg->digest = NULL;
+
+	msg->ranges = get_int32(tb[APMSG_NODE_RANGES]);
+
 	return true;
 }
 
@@ -156,3 +179,25 @@ bool parse_apmsg_sta(struct apmsg_sta *msg, struct blob_attr *data)
 
 	return true;
 }
+
+bool parse_apmsg_resync(struct apmsg_resync *msg, struct blob_attr *data)
+{
+	static const struct blob_attr_info policy[__APMSG_RESYNC_MAX] = {
+		[APMSG_RESYNC_ID] = { .type = BLOB_ATTR_INT32 },
+		[APMSG_RESYNC_NODE] = { .type = BLOB_ATTR_STRING },
+		[APMSG_RESYNC_RANGES] = { .type = BLOB_ATTR_INT32 },
+	};
+	struct blob_attr *tb[__APMSG_RESYNC_MAX];
+
+	blob_parse(data, tb, policy, __APMSG_RESYNC_MAX);
+	if (!tb[APMSG_RESYNC_ID] ||
+	    !tb[APMSG_RESYNC_NODE] ||
+	    !tb[APMSG_RESYNC_RANGES])
+		return false;
+
+	msg->id = blob_get_int32(tb[APMSG_RESYNC_ID]);
+	msg->node = blob_data(tb[APMSG_RESYNC_NODE]);
+	msg->ranges = blob_get_int32(tb[APMSG_RESYNC_RANGES]);
+
+	return true;
+}
@@ -0,0 +1,393 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name>
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org>
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <libubox/vlist.h>
+#include <libubox/avl-cmp.h>
+#include <libubox/usock.h>
+#include <libubox/ustream.h>
+#include "usteer.h"
+#include "remote.h"
+
+#define PEER_BACKOFF_MIN	1000
+#define PEER_BACKOFF_MAX	(60 * 1000)
+#define PEER_MAX_PENDING	(4 * APMGR_BUFLEN)
+
+struct usteer_peer;
+
+struct usteer_peer_conn {
+	struct ustream_fd s;
+	struct list_head list;
+
+	/* NULL for connections accepted from other hosts */
+	struct usteer_peer *peer;
+
+	char addr[INET6_ADDRSTRLEN];
+	uint8_t addr_bin[sizeof(struct in6_addr)];
+	int addr_len;
+	uint32_t id;
+	char *buf;
+	int buf_len;
+};
+
+struct usteer_peer {
+	struct vlist_node node;
+
+	struct usteer_peer_conn *conn;
+	struct uloop_timeout reconnect;
+	int backoff;
+};
+
+static void
+peers_update_cb(struct vlist_tree *tree,
+		struct vlist_node *node_new,
+		struct vlist_node *node_old);
+
+static VLIST_TREE(peers, avl_strcmp, peers_update_cb, true, true);
+static LIST_HEAD(peer_conns);
+static struct uloop_fd peer_server_fd;
+
+static const char *
+peer_name(struct usteer_peer *peer)
+{
+	return peer->node.avl.key;
+}
+
+static void
+peer_conn_free(struct usteer_peer_conn *conn)
+{
+	struct usteer_peer *peer = conn->peer;
+
+	list_del(&conn->list);
+	ustream_free(&conn->s.stream);
+	close(conn->s.fd.fd);
+	free(conn->buf);
+	free(conn);
+
+	if (!peer)
+		return;
+
+	peer->conn = NULL;
+	uloop_timeout_set(&peer->reconnect, peer->backoff);
+
+	peer->backoff *= 2;
+	if (peer->backoff > PEER_BACKOFF_MAX)
+		peer->backoff = PEER_BACKOFF_MAX;
+}
+
+static void
+peer_conn_recv(struct ustream *s, int bytes)
+{
+	struct usteer_peer_conn *conn = container_of(s, struct usteer_peer_conn, s.stream);
+	struct blob_attr *data;
+	uint32_t id;
+	int len, msg_len;
+
+	while (1) {
+		len = ustream_read(s, conn->buf + conn->buf_len, APMGR_BUFLEN - conn->buf_len);
+		if (len <= 0)
+			return;
+
+		conn->buf_len += len;
+
+		/* Messages are framed by the length of the outer blob attribute */
+		while (conn->buf_len >= sizeof(struct blob_attr)) {
+			data = (struct blob_attr *) conn->buf;
+			msg_len = blob_pad_len(data);
+			if (msg_len < sizeof(struct blob_attr) || msg_len > APMGR_BUFLEN) {
+				MSG(DEBUG, "Invalid frame from peer %s (len=%d)\n", conn->addr, msg_len);
+				/* Freed from the state callback, the stream is still in use here */
+				s->eof = true;
+				ustream_state_change(s);
+				return;
+			}
+
+			if (conn->buf_len < msg_len)
+				break;
+
+			id = usteer_recv_msg("tcp", conn->addr_bin, conn->addr_len,
+					     conn->buf, msg_len);
+			if (id && !conn->peer)
+				conn->id = id;
+
+			conn->buf_len -= msg_len;
+			memmove(conn->buf, conn->buf + msg_len, conn->buf_len);
+		}
+	}
+}
+
+static void
+peer_conn_write(struct ustream *s, int bytes)
+{
+	struct usteer_peer_conn *conn = container_of(s, struct usteer_peer_conn, s.stream);
+
+	/* Data went out, so the connection is established */
+	if (conn->peer)
+		conn->peer->backoff = PEER_BACKOFF_MIN;
+}
+
+static void
+peer_conn_state(struct ustream *s)
+{
+	struct usteer_peer_conn *conn = container_of(s, struct usteer_peer_conn, s.stream);
+
+	if (!s->eof && !s->write_error)
+		return;
+
+	MSG(INFO, "Connection to peer %s closed\n", conn->addr);
+	peer_conn_free(conn);
+}
+
+static struct usteer_peer_conn *
+peer_conn_add(int fd, const char *addr, struct usteer_peer *peer)
+{
+	struct usteer_peer_conn *conn;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->buf = malloc(APMGR_BUFLEN);
+	if (!conn->buf) {
+		free(conn);
+		return NULL;
+	}
+
+	snprintf(conn->addr, sizeof(conn->addr), "%s", addr);
+	if (inet_pton(AF_INET, addr, conn->addr_bin) == 1)
+		conn->addr_len = sizeof(struct in_addr);
+	else if (inet_pton(AF_INET6, addr, conn->addr_bin) == 1)
+		conn->addr_len = sizeof(struct in6_addr);
+	conn->peer = peer;
+	conn->s.stream.notify_read = peer_conn_recv;
+	conn->s.stream.notify_write = peer_conn_write;
+	conn->s.stream.notify_state = peer_conn_state;
+	ustream_fd_init(&conn->s, fd);
+	list_add_tail(&conn->list, &peer_conns);
+
+	return conn;
+}
+
+static void
+peer_connect(struct uloop_timeout *t)
+{
+	struct usteer_peer *peer = container_of(t, struct usteer_peer, reconnect);
+	int fd;
+
+	fd = usock(USOCK_TCP | USOCK_NONBLOCK | USOCK_NUMERIC,
+		   peer_name(peer), APMGR_PORT_STR);
+	if (fd < 0) {
+		MSG(DEBUG, "Failed to connect to peer %s\n", peer_name(peer));
+		goto retry;
+	}
+
+	peer->conn = peer_conn_add(fd, peer_name(peer), peer);
+	if (peer->conn)
+		return;
+
+	close(fd);
+retry:
+	uloop_timeout_set(&peer->reconnect, peer->backoff);
+	peer->backoff *= 2;
+	if (peer->backoff > PEER_BACKOFF_MAX)
+		peer->backoff = PEER_BACKOFF_MAX;
+}
+
+static void
+peer_free(struct usteer_peer *peer)
+{
+	uloop_timeout_cancel(&peer->reconnect);
+	if (peer->conn) {
+		/* Don't schedule a reconnect for a removed peer */
+		peer->conn->peer = NULL;
+		peer_conn_free(peer->conn);
+	}
+
+	avl_delete(&peers.avl, &peer->node.avl);
+	free(peer);
+}
+
+static void
+peers_update_cb(struct vlist_tree *tree,
+		struct vlist_node *node_new,
+		struct vlist_node *node_old)
+{
+	struct usteer_peer *peer;
+
+	if (node_new && node_old) {
+		peer = container_of(node_new, struct usteer_peer, node);
+		free(peer);
+	} else if (node_old) {
+		peer = container_of(node_old, struct usteer_peer, node);
+		peer_free(peer);
+	} else {
+		peer = container_of(node_new, struct usteer_peer, node);
+		peer->backoff = PEER_BACKOFF_MIN;
+		peer->reconnect.cb = peer_connect;
+		uloop_timeout_set(&peer->reconnect, 1);
+	}
+}
+
+static void
+peer_server_cb(struct uloop_fd *u, unsigned int events)
+{
+	struct sockaddr_storage sa;
+	socklen_t sl;
+	char addr[INET6_ADDRSTRLEN];
+	const void *in_addr;
+	int fd;
+
+	while (1) {
+		sl = sizeof(sa);
+		fd = accept(u->fd, (struct sockaddr *) &sa, &sl);
+		if (fd < 0) {
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+				return;
+			default:
+				perror("accept");
+				return;
+			}
+		}
+
+		if (sa.ss_family == AF_INET6)
+			in_addr = &((struct sockaddr_in6 *) &sa)->sin6_addr;
+		else
+			in_addr = &((struct sockaddr_in *) &sa)->sin_addr;
+
+		inet_ntop(sa.ss_family, in_addr, addr, sizeof(addr));
+		MSG(INFO, "Accepted connection from peer %s\n", addr);
+
+		if (!peer_conn_add(fd, addr, NULL))
+			close(fd);
+	}
+}
+
+static void
+peer_conn_send(void *priv, struct blob_attr *data)
+{
+	struct usteer_peer_conn *conn = priv;
+
+	if (ustream_pending_data(&conn->s.stream, true) > PEER_MAX_PENDING) {
+		MSG(DEBUG, "Peer %s is stalled, dropping message\n", conn->addr);
+		return;
+	}
+
+	ustream_write(&conn->s.stream, (const char *) data, blob_pad_len(data), false);
+}
+
+bool usteer_peer_active(void)
+{
+	return config.aggregator || !avl_is_empty(&peers.avl);
+}
+
+void usteer_peer_send_msg(struct blob_attr *data)
+{
+	struct usteer_peer_conn *conn;
+
+	list_for_each_entry(conn, &peer_conns, list) {
+		/* An aggregator also forwards to the hosts connected to it */
+		if (!conn->peer && !config.aggregator)
+			continue;
+
+		peer_conn_send(conn, data);
+	}
+}
+
+void usteer_peer_relay(void)
+{
+	struct usteer_peer_conn *conn;
+
+	list_for_each_entry(conn, &peer_conns, list) {
+		if (conn->peer || !conn->id)
+			continue;
+
+		usteer_relay_update(conn->id, conn, peer_conn_send);
+	}
+}
+
+void usteer_peer_reload(void)
+{
+	int type = USOCK_TCP | USOCK_SERVER | USOCK_NONBLOCK | USOCK_NUMERIC;
+
+	if (peer_server_fd.registered) {
+		uloop_fd_delete(&peer_server_fd);
+		close(peer_server_fd.fd);
+	}
+
+	if (!usteer_peer_active())
+		return;
+
+	if (config.ipv6)
+		peer_server_fd.fd = usock(type | USOCK_IPV6ONLY, "::", APMGR_PORT_STR);
+	else
+		peer_server_fd.fd = usock(type | USOCK_IPV4ONLY, "0.0.0.0", APMGR_PORT_STR);
+
+	if (peer_server_fd.fd < 0) {
+		perror("usock");
+		return;
+	}
+
+	peer_server_fd.cb = peer_server_cb;
+	uloop_fd_add(&peer_server_fd, ULOOP_READ);
+}
+
+void config_set_peers(struct blob_attr *data)
+{
+	struct usteer_peer *peer;
+	struct blob_attr *cur;
+	char *name_buf;
+	int rem;
+
+	if (!data)
+		return;
+
+	if (!blobmsg_check_attr_list(data, BLOBMSG_TYPE_STRING))
+		return;
+
+	vlist_update(&peers);
+	blobmsg_for_each_attr(cur, data, rem) {
+		const char *name = blobmsg_data(cur);
+
+		peer = calloc_a(sizeof(*peer), &name_buf, strlen(name) + 1);
+		strcpy(name_buf, name);
+		vlist_add(&peers, &peer->node, name_buf);
+	}
+	vlist_flush(&peers);
+}
+
+void config_get_peers(struct blob_buf *buf)
+{
+	struct usteer_peer *peer;
+	void *c;
+
+	c = blobmsg_open_array(buf, "peers");
+	vlist_for_each_element(&peers, peer, node) {
+		blobmsg_add_string(buf, NULL, peer_name(peer));
+	}
+	blobmsg_close_array(buf, c);
+}
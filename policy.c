@@ -119,7 +119,8 @@ usteer_policy_node_selectable_by_sta(struct sta_info *si_ref, struct sta_info *s
 	if (config.seen_policy_timeout < current_time - si_new->seen)
 		return false;
 
-	if (!usteer_policy_node_selectable_for_sta(si_ref->node, si_ref->signal, si_ref->node, si_ref->signal))
+	if (!usteer_policy_node_selectable_for_sta(si_ref->node, usteer_sta_info_signal(si_ref),
+						   si_ref->node, usteer_sta_info_signal(si_ref)))
 		return false;
 
 	return true;
@@ -129,8 +130,8 @@ bool
 usteer_policy_node_selectable_by_sta_measurement(struct usteer_measurement_report *mr_ref,
 						 struct usteer_measurement_report *mr_new, uint64_t max_age)
 {
-	int old_signal = usteer_rcpi_to_rssi(mr_ref->beacon_report.rcpi);
-	int new_signal = usteer_rcpi_to_rssi(mr_new->beacon_report.rcpi);
+	int old_signal = usteer_measurement_report_signal(mr_ref);
+	int new_signal = usteer_measurement_report_signal(mr_new);
 		
 	if (max_age && max_age < current_time - mr_new->timestamp)
 		return false;
@@ -322,7 +323,7 @@ is_more_kickable(struct sta_info *si_cur, struct sta_info *si_new)
 	if (si_new->kick_count > si_cur->kick_count)
 		return false;
 
-	return si_cur->signal > si_new->signal;
+	return usteer_sta_info_signal(si_cur) > usteer_sta_info_signal(si_new);
 }
 
 static void
@@ -468,7 +469,7 @@ usteer_roam_trigger_sm(struct sta_info *si)
 		break;
 
 	case ROAM_TRIGGER_WAIT_KICK:
-		if (si->signal > min_signal)
+		if (usteer_sta_info_signal(si) > min_signal)
 			break;
 
 		usteer_roam_set_state(si, ROAM_TRIGGER_NOTIFY_KICK, &ev);
@@ -489,6 +490,94 @@ usteer_roam_trigger_sm(struct sta_info *si)
 	return false;
 }
 
+/*
+ * Signal to compare against the roam thresholds. With roam_predict_horizon
+ * set, a falling signal is extrapolated so that scans start before the
+ * client crosses the threshold.
+ */
+static int
+usteer_roam_signal(struct sta_info *si)
+{
+	return usteer_signal_history_predict(&si->signal_history, usteer_sta_info_signal(si),
+					     config.roam_predict_horizon);
+}
+
+/*
+ * A predicted crossing of the roam threshold is held for the prediction
+ * horizon, so that a noisy slope does not stop and restart the roam scans on
+ * alternate runs. Without one, only the measured signal can release the client.
+ */
+static bool
+usteer_roam_signal_below(struct sta_info *si, int thold, bool hold)
+{
+	if (usteer_sta_info_signal(si) < thold)
+		return true;
+
+	if (usteer_roam_signal(si) < thold) {
+		if (hold)
+			si->roam_predict_until = current_time + config.roam_predict_horizon;
+		return true;
+	}
+
+	return current_time < si->roam_predict_until;
+}
+
+/* Highest signal the roam and SNR kick logic act upon, 0 if disabled */
+int
+usteer_policy_signal_threshold(struct usteer_node *node)
+{
+	int32_t snr[] = { config.min_snr, config.roam_scan_snr, config.roam_trigger_snr };
+	int thold = 0;
+	int signal;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(snr); i++) {
+		if (!snr[i])
+			continue;
+
+		signal = usteer_snr_to_signal(node, snr[i]);
+		if (!thold || signal > thold)
+			thold = signal;
+	}
+
+	return thold;
+}
+
+/* Called on signal updates, flags the node for the next policy run */
+void
+usteer_policy_signal_update(struct sta_info *si)
+{
+	struct usteer_local_node *ln;
+	int thold;
+
+	if (si->node->type != NODE_TYPE_LOCAL || si->connected != STA_CONNECTED)
+		return;
+
+	thold = usteer_policy_signal_threshold(si->node);
+	if (!thold || !usteer_roam_signal_below(si, thold, false))
+		return;
+
+	ln = container_of(si->node, struct usteer_local_node, node);
+	ln->signal_check = true;
+}
+
+static bool
+usteer_local_node_signal_below(struct usteer_local_node *ln)
+{
+	int thold = usteer_policy_signal_threshold(&ln->node);
+	struct sta_info *si;
+
+	if (!thold)
+		return false;
+
+	list_for_each_entry(si, &ln->node.sta_info, node_list) {
+		if (si->connected == STA_CONNECTED && usteer_roam_signal_below(si, thold, false))
+			return true;
+	}
+
+	return false;
+}
+
 static void
 usteer_local_node_roam_check(struct usteer_local_node *ln, struct uevent *ev)
 {
@@ -506,7 +595,7 @@ usteer_local_node_roam_check(struct usteer_local_node *ln, struct uevent *ev)
 	min_signal = usteer_snr_to_signal(&ln->node, min_signal);
 
 	list_for_each_entry(si, &ln->node.sta_info, node_list) {
-		if (si->connected != STA_CONNECTED || si->signal >= min_signal ||
+		if (si->connected != STA_CONNECTED || !usteer_roam_signal_below(si, min_signal, true) ||
 		    current_time - si->roam_kick < config.roam_trigger_interval) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_IDLE, ev);
 			usteer_scan_sm_request_source_stop(si, SCAN_RS_ROAM_SM);
@@ -542,7 +631,7 @@ usteer_local_node_snr_kick(struct usteer_local_node *ln)
 		if (si->connected != STA_CONNECTED)
 			continue;
 
-		if (si->signal >= min_signal) {
+		if (usteer_sta_info_signal(si) >= min_signal) {
 			si->below_min_snr = 0;
 			continue;
 		} else {
@@ -555,7 +644,7 @@ usteer_local_node_snr_kick(struct usteer_local_node *ln)
 		si->kick_count++;
 
 		ev.type = UEV_SIGNAL_KICK;
-		ev.threshold.cur = si->signal;
+		ev.threshold.cur = usteer_sta_info_signal(si);
 		ev.count = si->kick_count;
 		usteer_event(&ev);
 
@@ -622,8 +711,15 @@ usteer_local_node_kick(struct usteer_local_node *ln)
 		.node_local = &ln->node,
 	};
 
-	usteer_local_node_roam_check(ln, &ev);
-	usteer_local_node_snr_kick(ln);
+	/*
+	 * Walk the clients only while one of them is below a threshold. The
+	 * walk after the last one went above resets their roam state.
+	 */
+	if (ln->signal_check) {
+		ln->signal_check = usteer_local_node_signal_below(ln);
+		usteer_local_node_roam_check(ln, &ev);
+		usteer_local_node_snr_kick(ln);
+	}
 
 	list_for_each_entry(si, &ln->node.sta_info, node_list) {
 		usteer_scan_sm(si);
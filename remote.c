@@ -38,10 +38,18 @@ static uint32_t local_id;
 static struct uloop_fd remote_fd;
 static struct uloop_timeout remote_timer;
 static struct uloop_timeout reload_timer;
+static struct uloop_timeout resync_timer;
+static struct usteer_timeout_queue remote_node_tq;
+static struct usteer_timeout_queue remote_host_tq;
+static uint64_t last_full_update;
 
 static struct blob_buf buf;
 static uint32_t msg_seq;
 
+static void *usteer_update_init(uint32_t id, struct usteer_remote_host *origin,
+				struct blob_attr *host_info);
+static void usteer_send_msg(struct blob_attr *data);
+
 struct interface {
 	struct vlist_node node;
 	int ifindex;
@@ -57,7 +65,11 @@ static int remote_host_cmp(const void *k1, const void *k2, void *ptr)
 	unsigned long v1 = (unsigned long) k1;
 	unsigned long v2 = (unsigned long) k2;
 
-	return v2 - v1;
+	/* Chunked dumps resume with ordered lookups, needs a consistent order */
+	if (v1 != v2)
+		return v1 < v2 ? -1 : 1;
+
+	return 0;
 }
 
 static VLIST_TREE(interfaces, avl_strcmp, interfaces_update_cb, true, true);
@@ -202,11 +214,115 @@ interface_add_station(struct usteer_remote_node *node, struct blob_attr *data)
 	usteer_sta_info_update_timeout(si, msg.timeout);
 }
 
+/*
+ * Only stable state is hashed. The signal is quantized to 8 dB steps, since
+ * small fluctuations would otherwise trigger a resync on almost every update.
+ */
+static uint32_t
+usteer_sta_digest(struct sta_info *si)
+{
+	uint8_t data[6 + 2];
+	uint32_t hash = 2166136261U;
+	int i;
+
+	memcpy(data, si->sta->addr, 6);
+	data[6] = !!si->connected;
+	data[7] = (uint8_t) (usteer_sta_info_signal(si) >> 3);
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(data); i++) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static void
+usteer_node_digest(struct usteer_node *node, uint32_t *digest)
+{
+	struct sta_info *si;
+
+	/* XOR keeps the digest independent of the station list order */
+	memset(digest, 0, APMSG_STA_RANGES * sizeof(*digest));
+	list_for_each_entry(si, &node->sta_info, node_list)
+		digest[APMSG_STA_RANGE(si->sta->addr)] ^= usteer_sta_digest(si);
+}
+
+static int
+interface_addr_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+/* The message is authoritative for these ranges, drop stations it lacks */
+static void
+interface_prune_stations(struct usteer_remote_node *node, uint32_t ranges,
+			 struct blob_attr *stations)
+{
+	struct sta_info *si, *tmp;
+	struct apmsg_sta msg;
+	struct blob_attr *cur;
+	uint8_t (*addrs)[6] = NULL;
+	int n_addrs = 0;
+	int rem;
+
+	if (stations) {
+		addrs = calloc(blob_len(stations) / sizeof(struct blob_attr) + 1, sizeof(*addrs));
+		if (!addrs)
+			return;
+
+		blob_for_each_attr(cur, stations, rem) {
+			if (parse_apmsg_sta(&msg, cur))
+				memcpy(addrs[n_addrs++], msg.addr, sizeof(*addrs));
+		}
+		qsort(addrs, n_addrs, sizeof(*addrs), interface_addr_cmp);
+	}
+
+	list_for_each_entry_safe(si, tmp, &node->node.sta_info, node_list) {
+		if (!(ranges & (1 << APMSG_STA_RANGE(si->sta->addr))))
+			continue;
+
+		if (n_addrs && bsearch(si->sta->addr, addrs, n_addrs, sizeof(*addrs),
+				       interface_addr_cmp))
+			continue;
+
+		usteer_sta_info_del(si);
+	}
+
+	free(addrs);
+}
+
+static uint32_t
+interface_check_digest(struct usteer_remote_node *node, const uint32_t *digest)
+{
+	uint32_t local[APMSG_STA_RANGES];
+	uint32_t ranges = 0;
+	int i;
+
+	usteer_node_digest(&node->node, local);
+	for (i = 0; i < APMSG_STA_RANGES; i++)
+		if (local[i] != ntohl(digest[i]))
+			ranges |= 1 << i;
+
+	return ranges;
+}
+
+static void
+remote_host_free(struct usteer_remote_host *host)
+{
+	usteer_timeout_cancel(&remote_host_tq, &host->timeout);
+	avl_delete(&remote_hosts, &host->avl);
+	free(host->host_info);
+	free(host);
+}
+
 static void
 remote_node_free(struct usteer_remote_node *node)
 {
 	struct usteer_remote_host *host = node->host;
 
+	usteer_timeout_cancel(&remote_node_tq, &node->timeout);
 	list_del(&node->list);
 	list_del(&node->host_list);
 	usteer_sta_node_cleanup(&node->node);
@@ -216,13 +332,50 @@ remote_node_free(struct usteer_remote_node *node)
 	if (!list_empty(&host->nodes))
 		return;
 
-	avl_delete(&remote_hosts, &host->avl);
-	free(host->addr);
-	free(host);
+	remote_host_free(host);
+}
+
+/* Without remote_timeout, fall back to the legacy number of update intervals */
+static int
+remote_timeout(void)
+{
+	if (config.remote_timeout)
+		return config.remote_timeout;
+
+	return config.remote_node_timeout * config.remote_update_interval;
+}
+
+static void
+remote_node_timeout(struct usteer_timeout_queue *q, struct usteer_timeout *t)
+{
+	struct usteer_remote_node *node = container_of(t, struct usteer_remote_node, timeout);
+
+	MSG(DEBUG, "Remote node %s timed out\n", usteer_node_name(&node->node));
+	remote_node_free(node);
+}
+
+static void
+remote_host_timeout(struct usteer_timeout_queue *q, struct usteer_timeout *t)
+{
+	struct usteer_remote_host *host = container_of(t, struct usteer_remote_host, timeout);
+	struct usteer_remote_node *node;
+	bool last;
+
+	if (list_empty(&host->nodes)) {
+		remote_host_free(host);
+		return;
+	}
+
+	/* Freeing the last node also frees the host */
+	do {
+		node = list_first_entry(&host->nodes, struct usteer_remote_node, host_list);
+		last = list_is_last(&node->host_list, &host->nodes);
+		remote_node_free(node);
+	} while (!last);
 }
 
 static struct usteer_remote_host *
-interface_get_host(const char *addr, unsigned long id)
+interface_get_host(const void *addr, int addr_len, unsigned long id)
 {
 	struct usteer_remote_host *host;
 
@@ -236,11 +389,13 @@ interface_get_host(const char *addr, unsigned long id)
 	avl_insert(&remote_hosts, &host->avl);
 
 out:
-	if (host->addr && !strcmp(host->addr, addr))
+	if (host->addr_len == addr_len && !memcmp(host->addr_bin, addr, addr_len))
 		return host;
 
-	free(host->addr);
-	host->addr = strdup(addr);
+	memcpy(host->addr_bin, addr, addr_len);
+	host->addr_len = addr_len;
+	inet_ntop(addr_len == sizeof(struct in_addr) ? AF_INET : AF_INET6,
+		  addr, host->addr, sizeof(host->addr));
 
 	return host;
 }
@@ -274,8 +429,64 @@ interface_get_node(struct usteer_remote_host *host, const char *name)
 }
 
 static void
-interface_add_node(struct usteer_remote_host *host, struct blob_attr *data)
+interface_request_resync(void **resync, struct usteer_remote_node *node,
+			 uint32_t ranges)
+{
+	void *c;
+
+	if (!*resync) {
+		c = usteer_update_init(local_id, NULL, NULL);
+		blob_nest_end(&buf, c);
+		*resync = blob_nest_start(&buf, APMSG_RESYNC);
+	}
+
+	MSG(NETWORK, "Requesting resync of node %s (ranges=%04x)\n",
+	    usteer_node_name(&node->node), ranges);
+
+	c = blob_nest_start(&buf, 0);
+	blob_put_int32(&buf, APMSG_RESYNC_ID, (unsigned long) node->host->avl.key);
+	blob_put_string(&buf, APMSG_RESYNC_NODE, node->name);
+	blob_put_int32(&buf, APMSG_RESYNC_RANGES, ranges);
+	blob_nest_end(&buf, c);
+}
+
+static void
+interface_send_resync(void *resync)
+{
+	blob_nest_end(&buf, resync);
+	usteer_send_msg(buf.head);
+}
+
+static void
+interface_handle_resync(struct blob_attr *data)
+{
+	struct usteer_local_node *ln;
+	struct apmsg_resync msg;
+	struct blob_attr *cur;
+	int rem;
+
+	blob_for_each_attr(cur, data, rem) {
+		if (!parse_apmsg_resync(&msg, cur) || msg.id != local_id)
+			continue;
+
+		ln = avl_find_element(&local_nodes, msg.node, ln, node.avl);
+		if (!ln)
+			continue;
+
+		ln->resync_ranges |= msg.ranges;
+
+		/* Coalesce requests from multiple peers into one reply */
+		if (!resync_timer.pending)
+			uloop_timeout_set(&resync_timer, 100);
+	}
+}
+
+static void
+interface_add_node(struct usteer_remote_host *host, struct blob_attr *data,
+		   void **resync)
 {
+	uint32_t ranges;
+
 	struct usteer_remote_node *node;
 	struct apmsg_node msg;
 	struct blob_attr *cur;
@@ -287,7 +498,7 @@ interface_add_node(struct usteer_remote_host *host, struct blob_attr *data)
 	}
 
 	node = interface_get_node(host, msg.name);
-	node->check = 0;
+	usteer_timeout_set(&remote_node_tq, &node->timeout, remote_timeout());
 	node->node.freq = msg.freq;
 	node->node.channel = msg.channel;
 	node->node.op_class = msg.op_class;
@@ -300,42 +511,77 @@ interface_add_node(struct usteer_remote_host *host, struct blob_attr *data)
 
 	snprintf(node->node.ssid, sizeof(node->node.ssid), "%s", msg.ssid);
 	usteer_node_set_blob(&node->node.rrm_nr, msg.rrm_nr);
-	usteer_node_set_blob(&node->node.node_info, msg.node_info);
+	/* Senders omit unchanged node_info, an empty one clears it */
+	if (msg.node_info)
+		usteer_node_set_blob(&node->node.node_info,
+				     blob_len(msg.node_info) ? msg.node_info : NULL);
 
 	blob_for_each_attr(cur, msg.stations, rem)
 		interface_add_station(node, cur);
+
+	if (msg.ranges)
+		interface_prune_stations(node, msg.ranges, msg.stations);
+
+	if (!msg.digest)
+		return;
+
+	ranges = interface_check_digest(node, msg.digest);
+	if (ranges)
+		interface_request_resync(resync, node, ranges);
 }
 
-static void
-interface_recv_msg(struct interface *iface, char *addr_str, void *buf, int len)
+/* Returns the id of the sending host, or 0 for invalid messages */
+uint32_t
+usteer_recv_msg(const char *src, const void *addr, int addr_len,
+		void *buf, int len)
 {
 	struct usteer_remote_host *host;
 	struct blob_attr *data = buf;
 	struct apmsg msg;
 	struct blob_attr *cur;
+	void *resync = NULL;
 	int rem;
 
 	if (blob_pad_len(data) != len) {
 		MSG(DEBUG, "Invalid message length (header: %d, real: %d)\n", blob_pad_len(data), len);
-		return;
+		return 0;
 	}
 
 	if (!parse_apmsg(&msg, data)) {
 		MSG(DEBUG, "Missing fields in message\n");
-		return;
+		return 0;
 	}
 
 	if (msg.id == local_id)
-		return;
+		return msg.id;
 
 	MSG(NETWORK, "Received message on %s (id=%08x->%08x seq=%d len=%d)\n",
-		interface_name(iface), msg.id, local_id, msg.seq, len);
+		src, msg.id, local_id, msg.seq, len);
 
-	host = interface_get_host(addr_str, msg.id);
-	usteer_node_set_blob(&host->host_info, msg.host_info);
+	if (msg.resync) {
+		interface_handle_resync(msg.resync);
+		return msg.id;
+	}
+
+	/* Messages relayed by an aggregator carry the address of their origin */
+	if (msg.host_addr) {
+		addr = msg.host_addr;
+		addr_len = msg.host_addr_len;
+	}
+
+	host = interface_get_host(addr, addr_len, msg.id);
+	usteer_timeout_set(&remote_host_tq, &host->timeout, remote_timeout());
+	if (msg.host_info)
+		usteer_node_set_blob(&host->host_info,
+				     blob_len(msg.host_info) ? msg.host_info : NULL);
 
 	blob_for_each_attr(cur, msg.nodes, rem)
-		interface_add_node(host, cur);
+		interface_add_node(host, cur, &resync);
+
+	if (resync)
+		interface_send_resync(resync);
+
+	return msg.id;
 }
 
 static struct interface *
@@ -357,7 +603,6 @@ interface_recv_v4(struct uloop_fd *u, unsigned int events)
 	static char buf[APMGR_BUFLEN];
 	static char cmsg_buf[( CMSG_SPACE(sizeof(struct in_pktinfo)) + sizeof(int)) + 1];
 	static struct sockaddr_in sin;
-	char addr_str[INET_ADDRSTRLEN];
 	static struct iovec iov = {
 		.iov_base = buf,
 		.iov_len = sizeof(buf)
@@ -409,9 +654,8 @@ interface_recv_v4(struct uloop_fd *u, unsigned int events)
 			continue;
 		}
 
-		inet_ntop(AF_INET, &sin.sin_addr, addr_str, sizeof(addr_str));
-
-		interface_recv_msg(iface, addr_str, buf, len);
+		usteer_recv_msg(interface_name(iface), &sin.sin_addr,
+				sizeof(sin.sin_addr), buf, len);
 	} while (1);
 }
 
@@ -433,7 +677,6 @@ static void interface_recv_v6(struct uloop_fd *u, unsigned int events){
 		.msg_controllen = sizeof(cmsg_buf),
 	};
 	struct cmsghdr *cmsg;
-	char addr_str[INET6_ADDRSTRLEN];
 	int len;
 
 	do {
@@ -472,13 +715,13 @@ static void interface_recv_v6(struct uloop_fd *u, unsigned int events){
 			continue;
 		}
 
-		inet_ntop(AF_INET6, &sin.sin6_addr, addr_str, sizeof(addr_str));
 		if (sin.sin6_addr.s6_addr[0] == 0) {
 			/* IPv4 mapped address. Ignore. */
 			continue;
 		}
 
-		interface_recv_msg(iface, addr_str, buf, len);
+		usteer_recv_msg(interface_name(iface), &sin.sin6_addr,
+				sizeof(sin.sin6_addr), buf, len);
 	} while (1);
 }
 
@@ -549,20 +792,108 @@ static void usteer_send_sta_info(struct sta_info *sta)
 	c = blob_nest_start(&buf, 0);
 	blob_put(&buf, APMSG_STA_ADDR, sta->sta->addr, 6);
 	blob_put_int8(&buf, APMSG_STA_CONNECTED, !!sta->connected);
-	blob_put_int32(&buf, APMSG_STA_SIGNAL, sta->signal);
+	blob_put_int32(&buf, APMSG_STA_SIGNAL, usteer_sta_info_signal(sta));
 	blob_put_int32(&buf, APMSG_STA_SEEN, seen);
 	blob_put_int32(&buf, APMSG_STA_LAST_CONNECTED, last_connected);
 	blob_put_int32(&buf, APMSG_STA_TIMEOUT, config.local_sta_timeout - seen);
 	blob_nest_end(&buf, c);
 }
 
-static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
+static bool
+relay_host_has_sta(struct usteer_remote_host *dest, struct sta *sta)
+{
+	struct usteer_remote_node *rn;
+	struct sta_info *si;
+
+	list_for_each_entry(si, &sta->nodes, list) {
+		if (si->node->type != NODE_TYPE_REMOTE)
+			continue;
+
+		rn = container_of(si->node, struct usteer_remote_node, node);
+		if (rn->host == dest)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+relay_node_relevant(struct usteer_remote_host *dest, struct usteer_node *node)
+{
+	struct usteer_remote_node *rn;
+	struct sta_info *si;
+	bool found = false;
+
+	list_for_each_entry(rn, &dest->nodes, host_list) {
+		if (strcmp(rn->node.ssid, node->ssid) != 0)
+			continue;
+
+		found = true;
+		break;
+	}
+
+	if (!found)
+		return false;
+
+	list_for_each_entry(si, &node->sta_info, node_list)
+		if (relay_host_has_sta(dest, si->sta))
+			return true;
+
+	return false;
+}
+
+static struct blob_attr *
+usteer_info_blob(struct blob_attr *info)
 {
+	static struct blob_attr empty;
+
+	if (info)
+		return info;
+
+	blob_set_raw_len(&empty, sizeof(empty));
+	return &empty;
+}
+
+/*
+ * Returns the info blob to send, or NULL if the receivers already have the
+ * current version. Full updates always carry it, an empty blob clears it.
+ */
+static struct blob_attr *
+usteer_info_update(struct blob_attr *info, uint32_t version, uint32_t *sent,
+		   bool full)
+{
+	if (!full && version == *sent)
+		return NULL;
+
+	*sent = version;
+	return usteer_info_blob(info);
+}
+
+static struct blob_attr *
+usteer_host_info_update(bool full)
+{
+	static uint32_t host_info_sent;
+
+	return usteer_info_update(host_info_blob, host_info_version,
+				  &host_info_sent, full);
+}
+
+/*
+ * ranges selects the stations to include: ~0 for all of them, 0 for none
+ * (heartbeat), anything else for an authoritative resync reply.
+ */
+static void usteer_send_node(struct usteer_node *node, const char *name,
+			     struct sta_info *sta, struct usteer_remote_host *dest,
+			     uint32_t ranges)
+{
+	uint32_t digest[APMSG_STA_RANGES];
+	struct blob_attr *info;
 	void *c, *s, *r;
+	int i;
 
 	c = blob_nest_start(&buf, 0);
 
-	blob_put_string(&buf, APMSG_NODE_NAME, usteer_node_name(node));
+	blob_put_string(&buf, APMSG_NODE_NAME, name);
 	blob_put_string(&buf, APMSG_NODE_SSID, node->ssid);
 	blob_put_int32(&buf, APMSG_NODE_FREQ, node->freq);
 	blob_put_int32(&buf, APMSG_NODE_NOISE, node->noise);
@@ -580,18 +911,35 @@ static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
 		blob_nest_end(&buf, r);
 	}
 
-	if (node->node_info)
-		blob_put(&buf, APMSG_NODE_NODE_INFO,
-			 blob_data(node->node_info),
-			 blob_len(node->node_info));
+	info = usteer_info_update(node->node_info, node->node_info_version,
+				  &node->node_info_sent, ranges == ~0U);
+	if (info)
+		blob_put(&buf, APMSG_NODE_NODE_INFO, blob_data(info), blob_len(info));
+
+	if (!sta && !dest) {
+		usteer_node_digest(node, digest);
+		for (i = 0; i < APMSG_STA_RANGES; i++)
+			digest[i] = htonl(digest[i]);
+		blob_put(&buf, APMSG_NODE_DIGEST, digest, sizeof(digest));
+	}
+
+	if (ranges && ranges != ~0U)
+		blob_put_int32(&buf, APMSG_NODE_RANGES, ranges);
 
 	s = blob_nest_start(&buf, APMSG_NODE_STATIONS);
 
 	if (sta) {
 		usteer_send_sta_info(sta);
 	} else {
-		list_for_each_entry(sta, &node->sta_info, node_list)
+		list_for_each_entry(sta, &node->sta_info, node_list) {
+			if (!(ranges & (1 << APMSG_STA_RANGE(sta->sta->addr))))
+				continue;
+
+			if (dest && !relay_host_has_sta(dest, sta->sta))
+				continue;
+
 			usteer_send_sta_info(sta);
+		}
 	}
 
 	blob_nest_end(&buf, s);
@@ -599,68 +947,127 @@ static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
 	blob_nest_end(&buf, c);
 }
 
-static void
-usteer_check_timeout(void)
-{
-	struct usteer_remote_node *node, *tmp;
-	int timeout = config.remote_node_timeout;
-
-	list_for_each_entry_safe(node, tmp, &remote_nodes, list) {
-		if (node->check++ > timeout)
-			remote_node_free(node);
-	}
-}
-
 static void *
-usteer_update_init(void)
+usteer_update_init(uint32_t id, struct usteer_remote_host *origin,
+		   struct blob_attr *host_info)
 {
 	blob_buf_init(&buf, 0);
-	blob_put_int32(&buf, APMSG_ID, local_id);
+	blob_put_int32(&buf, APMSG_ID, id);
 	blob_put_int32(&buf, APMSG_SEQ, ++msg_seq);
-	if (host_info_blob)
+	if (origin)
+		blob_put(&buf, APMSG_HOST_ADDR, origin->addr_bin, origin->addr_len);
+	if (host_info)
 		blob_put(&buf, APMSG_HOST_INFO,
-			 blob_data(host_info_blob),
-			 blob_len(host_info_blob));
+			 blob_data(host_info),
+			 blob_len(host_info));
 
 	return blob_nest_start(&buf, APMSG_NODES);
 }
 
 static void
-usteer_update_send(void *c)
+usteer_send_msg(struct blob_attr *data)
 {
 	struct interface *iface;
 
-	blob_nest_end(&buf, c);
+	if (usteer_peer_active()) {
+		usteer_peer_send_msg(data);
+		return;
+	}
 
 	vlist_for_each_element(&interfaces, iface, node)
-		interface_send_msg(iface, buf.head);
+		interface_send_msg(iface, data);
+}
+
+static void
+usteer_update_send(void *c)
+{
+	blob_nest_end(&buf, c);
+	usteer_send_msg(buf.head);
 }
 
 void
 usteer_send_sta_update(struct sta_info *si)
 {
-	void *c = usteer_update_init();
-	usteer_send_node(si->node, si);
+	void *c = usteer_update_init(local_id, NULL, usteer_host_info_update(false));
+	usteer_send_node(si->node, usteer_node_name(si->node), si, NULL, 0);
 	usteer_update_send(c);
 }
 
+/*
+ * Send the merged view to a host connected to this aggregator: one message
+ * per origin host, limited to nodes serving the same SSID as one of the
+ * destination's nodes and sharing stations with it.
+ */
+void usteer_relay_update(uint32_t dest_id, void *priv,
+			 void (*send)(void *priv, struct blob_attr *data))
+{
+	struct usteer_remote_host *dest, *host;
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	int n_nodes;
+	void *c;
+
+	dest = avl_find_element(&remote_hosts, (void *)(unsigned long) dest_id, dest, avl);
+	if (!dest)
+		return;
+
+	c = usteer_update_init(local_id, NULL, usteer_host_info_update(true));
+	for_each_local_node(node) {
+		if (relay_node_relevant(dest, node))
+			usteer_send_node(node, usteer_node_name(node), NULL, dest, ~0U);
+	}
+	blob_nest_end(&buf, c);
+	send(priv, buf.head);
+
+	avl_for_each_element(&remote_hosts, host, avl) {
+		if (host == dest)
+			continue;
+
+		n_nodes = 0;
+		c = usteer_update_init((unsigned long) host->avl.key, host,
+				       usteer_info_blob(host->host_info));
+		list_for_each_entry(rn, &host->nodes, host_list) {
+			if (!relay_node_relevant(dest, &rn->node))
+				continue;
+
+			usteer_send_node(&rn->node, rn->name, NULL, dest, ~0U);
+			n_nodes++;
+		}
+
+		if (!n_nodes)
+			continue;
+
+		blob_nest_end(&buf, c);
+		send(priv, buf.head);
+	}
+}
+
 static void
 usteer_send_update_timer(struct uloop_timeout *t)
 {
 	struct usteer_node *node;
+	uint32_t ranges = ~0U;
 	void *c;
 
 	usteer_update_time();
 	uloop_timeout_set(t, config.remote_update_interval);
 
-	if (!avl_is_empty(&local_nodes) || host_info_blob) {
-		c = usteer_update_init();
+	/* Between full updates, only send digests of the station state */
+	if (config.remote_full_update_interval &&
+	    current_time - last_full_update < config.remote_full_update_interval)
+		ranges = 0;
+	else
+		last_full_update = current_time;
+
+	if (config.aggregator) {
+		usteer_peer_relay();
+	} else if (!avl_is_empty(&local_nodes) || host_info_blob) {
+		c = usteer_update_init(local_id, NULL, usteer_host_info_update(ranges == ~0U));
 		for_each_local_node(node)
-			usteer_send_node(node, NULL);
+			usteer_send_node(node, usteer_node_name(node), NULL, NULL, ranges);
 
 		usteer_update_send(c);
 	}
-	usteer_check_timeout();
 }
 
 static int
@@ -751,17 +1158,47 @@ static void usteer_reload_timer(struct uloop_timeout *t) {
 		remote_fd.cb = interface_recv_v4;
 	}
 
+	usteer_peer_reload();
+
 	if (remote_fd.fd < 0)
 		return;
 
 	uloop_fd_add(&remote_fd, ULOOP_READ);
 }
 
+static void
+usteer_resync_timer(struct uloop_timeout *t)
+{
+	struct usteer_local_node *ln;
+	void *c;
+
+	c = usteer_update_init(local_id, NULL, usteer_host_info_update(false));
+	avl_for_each_element(&local_nodes, ln, node.avl) {
+		if (!ln->resync_ranges)
+			continue;
+
+		usteer_send_node(&ln->node, usteer_node_name(&ln->node), NULL, NULL,
+				 ln->resync_ranges);
+		ln->resync_ranges = 0;
+	}
+	usteer_update_send(c);
+}
+
+static void __usteer_init usteer_remote_init(void)
+{
+	usteer_timeout_init(&remote_node_tq);
+	remote_node_tq.cb = remote_node_timeout;
+	usteer_timeout_init(&remote_host_tq);
+	remote_host_tq.cb = remote_host_timeout;
+}
+
 int usteer_interface_init(void)
 {
 	if (usteer_init_local_id())
 		return -1;
 
+	resync_timer.cb = usteer_resync_timer;
+
 	remote_timer.cb = usteer_send_update_timer;
 	remote_timer.cb(&remote_timer);
 
@@ -27,6 +27,8 @@ enum {
 	APMSG_SEQ,
 	APMSG_NODES,
 	APMSG_HOST_INFO,
+	APMSG_HOST_ADDR,
+	APMSG_RESYNC,
 	__APMSG_MAX
 };
 
@@ -35,6 +37,26 @@ struct apmsg {
 	uint32_t seq;
 	struct blob_attr *nodes;
 	struct blob_attr *host_info;
+	const void *host_addr;
+	int host_addr_len;
+	struct blob_attr *resync;
+};
+
+/* Stations are split into ranges by the low nibble of their address */
+#define APMSG_STA_RANGES	16
+#define APMSG_STA_RANGE(addr)	((addr)[5] & (APMSG_STA_RANGES - 1))
+
+enum {
+	APMSG_RESYNC_ID,
+	APMSG_RESYNC_NODE,
+	APMSG_RESYNC_RANGES,
+	__APMSG_RESYNC_MAX
+};
+
+struct apmsg_resync {
+	uint32_t id;
+	const char *node;
+	uint32_t ranges;
 };
 
 enum {
@@ -51,6 +73,8 @@ enum {
 	APMSG_NODE_BSSID,
 	APMSG_NODE_CHANNEL,
 	APMSG_NODE_OP_CLASS,
+	APMSG_NODE_DIGEST,
+	APMSG_NODE_RANGES,
 	__APMSG_NODE_MAX
 };
 
@@ -68,6 +92,8 @@ struct apmsg_node {
 	struct blob_attr *stations;
 	struct blob_attr *rrm_nr;
 	struct blob_attr *node_info;
+	const uint32_t *digest;
+	uint32_t ranges;
 };
 
 enum {
@@ -93,5 +119,16 @@ struct apmsg_sta {
 bool parse_apmsg(struct apmsg *msg, struct blob_attr *data);
 bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data);
 bool parse_apmsg_sta(struct apmsg_sta *msg, struct blob_attr *data);
+bool parse_apmsg_resync(struct apmsg_resync *msg, struct blob_attr *data);
+
+uint32_t usteer_recv_msg(const char *src, const void *addr, int addr_len,
+			void *buf, int len);
+void usteer_relay_update(uint32_t dest_id, void *priv,
+			 void (*send)(void *priv, struct blob_attr *data));
+
+bool usteer_peer_active(void);
+void usteer_peer_send_msg(struct blob_attr *data);
+void usteer_peer_relay(void);
+void usteer_peer_reload(void);
 
 #endif
@@ -0,0 +1,251 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+/*
+ * Replays recorded signal traces through the roam signal predictor and
+ * reports how early it anticipates threshold crossings and how often it
+ * triggers without one following.
+ *
+ * A trace holds one station's samples as "<time in ms> <signal in dBm>"
+ * lines, lines starting with '#' are ignored.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "signal.h"
+
+struct replay_stats {
+	unsigned int samples;
+	unsigned int crossings;
+	unsigned int predicted;
+	unsigned int missed;
+	unsigned int false_triggers;
+
+	uint64_t lead_sum;
+	uint64_t lead_min;
+	uint64_t lead_max;
+};
+
+static int threshold;
+static uint32_t horizon = 10000;
+static bool smoothing;
+static int verbose;
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s <options> [<trace>...]\n"
+		"Options:\n"
+		"	-t <dbm>:			roam threshold signal (required)\n"
+		"	-H <msec>:			prediction horizon (default: 10000)\n"
+		"	-s:				compare the mean of the signal history, as with signal_smoothing\n"
+		"	-v:				print every trigger and crossing\n"
+		"\n"
+		"Reads the trace from stdin if none is given\n"
+		"\n", prog);
+	return 1;
+}
+
+static void
+replay_lead(struct replay_stats *st, uint64_t lead)
+{
+	if (!st->predicted || lead < st->lead_min)
+		st->lead_min = lead;
+	if (lead > st->lead_max)
+		st->lead_max = lead;
+
+	st->lead_sum += lead;
+	st->predicted++;
+}
+
+static int
+replay_trace(FILE *f, const char *name, struct replay_stats *st)
+{
+	struct usteer_signal_history h = {};
+	uint64_t trigger = 0, hold_until = 0;
+	uint64_t time, last = 0;
+	bool pending = false, below = false;
+	int measured, signal;
+	char line[128];
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%" SCNu64 " %d", &time, &signal) != 2) {
+			fprintf(stderr, "%s: invalid line: %s", name, line);
+			return -1;
+		}
+
+		if (time < last) {
+			fprintf(stderr, "%s: time %" PRIu64 " goes backwards\n", name, time);
+			return -1;
+		}
+
+		last = time;
+		st->samples++;
+		usteer_signal_history_add(&h, time, signal);
+		measured = smoothing ? usteer_signal_history_mean(&h) : signal;
+
+		/* Like the roam policy, a prediction is held for the horizon */
+		if (pending && time >= hold_until) {
+			if (verbose)
+				printf("%s: %" PRIu64 ": false trigger from %" PRIu64 "\n",
+				       name, time, trigger);
+			st->false_triggers++;
+			pending = false;
+		}
+
+		if (measured < threshold) {
+			if (below)
+				continue;
+
+			below = true;
+			st->crossings++;
+			if (pending) {
+				if (verbose)
+					printf("%s: %" PRIu64 ": crossing, predicted %" PRIu64 " ms ahead\n",
+					       name, time, time - trigger);
+				replay_lead(st, time - trigger);
+			} else {
+				if (verbose)
+					printf("%s: %" PRIu64 ": crossing, not predicted\n", name, time);
+				st->missed++;
+			}
+			pending = false;
+			continue;
+		}
+
+		below = false;
+		if (usteer_signal_history_predict(&h, measured, horizon) >= threshold)
+			continue;
+
+		if (!pending) {
+			if (verbose)
+				printf("%s: %" PRIu64 ": predicted trigger at %d dBm\n",
+				       name, time, measured);
+			trigger = time;
+			pending = true;
+		}
+		hold_until = time + horizon;
+	}
+
+	/* A trigger still held at the end of the trace is not counted */
+	return 0;
+}
+
+static void
+replay_print(const char *name, struct replay_stats *st)
+{
+	printf("%s: samples %u crossings %u predicted %u missed %u false %u",
+	       name, st->samples, st->crossings, st->predicted, st->missed,
+	       st->false_triggers);
+
+	if (st->predicted)
+		printf(" lead avg %" PRIu64 " min %" PRIu64 " max %" PRIu64 " ms",
+		       st->lead_sum / st->predicted, st->lead_min, st->lead_max);
+
+	printf("\n");
+}
+
+static void
+replay_add(struct replay_stats *total, struct replay_stats *st)
+{
+	if (st->predicted &&
+	    (!total->predicted || st->lead_min < total->lead_min))
+		total->lead_min = st->lead_min;
+	if (st->lead_max > total->lead_max)
+		total->lead_max = st->lead_max;
+
+	total->samples += st->samples;
+	total->crossings += st->crossings;
+	total->predicted += st->predicted;
+	total->missed += st->missed;
+	total->false_triggers += st->false_triggers;
+	total->lead_sum += st->lead_sum;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_stats total = {};
+	bool has_threshold = false;
+	int ret = 0;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "t:H:sv")) != -1) {
+		switch(ch) {
+		case 't':
+			threshold = atoi(optarg);
+			has_threshold = true;
+			break;
+		case 'H':
+			horizon = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			smoothing = true;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (!has_threshold)
+		goto usage;
+
+	if (optind == argc) {
+		if (replay_trace(stdin, "stdin", &total))
+			return 1;
+
+		replay_print("stdin", &total);
+		return 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		struct replay_stats st = {};
+		FILE *f;
+
+		f = fopen(argv[i], "r");
+		if (!f) {
+			perror(argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		if (replay_trace(f, argv[i], &st)) {
+			ret = 1;
+		} else {
+			replay_print(argv[i], &st);
+			replay_add(&total, &st);
+		}
+		fclose(f);
+	}
+
+	if (argc - optind > 1)
+		replay_print("total", &total);
+
+	return ret;
+usage:
+	return usage(argv[0]);
+}
@@ -58,6 +58,10 @@ usteer_scan_state_name(enum scan_state ss)
 			return "IDLE";
 		case SCAN_START:
 			return "START";
+		case SCAN_TABLE_2_GHZ:
+			return "TABLE_2_GHZ";
+		case SCAN_TABLE_5_GHZ:
+			return "TABLE_5_GHZ";
 		case SCAN_ACTIVE_2_GHZ:
 			return "ACTIVE_2_GHZ";
 		case SCAN_ACTIVE_5_GHZ:
@@ -73,6 +77,57 @@ usteer_scan_state_name(enum scan_state ss)
 	return "UNKNOWN";
 }
 
+/*
+ * A report of the node is missing, too old to be used by the policy or
+ * was received before the current scan run started.
+ */
+static bool
+usteer_scan_node_stale(struct sta_info *si, struct usteer_node *node)
+{
+	struct usteer_measurement_report *mr;
+
+	mr = usteer_measurement_report_get(si->sta, node, false);
+	if (!mr || mr->timestamp < si->scan_data.start)
+		return true;
+
+	return current_time - mr->timestamp > config.measurement_policy_timeout;
+}
+
+static bool
+usteer_scan_band_stale(struct sta_info *si, bool band_5ghz)
+{
+	struct usteer_node *n = NULL;
+
+	while ((n = usteer_node_get_next_neighbor(si->node, n)) != NULL) {
+		if ((n->freq > 4000) == band_5ghz && usteer_scan_node_stale(si, n))
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+usteer_scan_sm_request(struct sta_info *si, bool stale,
+		       enum usteer_beacon_measurement_mode mode, int op_class, int channel)
+{
+	if (!stale) {
+		si->scan_data.skipped++;
+		return false;
+	}
+
+	if (usteer_ubus_send_beacon_request(si, mode, op_class, channel))
+		return false;
+
+	si->scan_data.requests++;
+	si->scan_data.event = current_time;
+	return true;
+}
+
+/*
+ * Every state issues at most one beacon request per roam_scan_interval.
+ * States whose channels are covered by fresh reports, e.g. from a previous
+ * table mode request, are passed through without waiting.
+ */
 enum scan_state
 usteer_scan_sm(struct sta_info *si)
 {
@@ -91,45 +146,63 @@ usteer_scan_sm(struct sta_info *si)
 	switch (si->scan_data.state) {
 		case SCAN_IDLE:
 			si->scan_data.last_passive_scan_idx = 0;
+			si->scan_data.start = current_time;
 			si->scan_data.state++;
 		case SCAN_START:
 			si->scan_data.state++;
+		case SCAN_TABLE_2_GHZ:
+			/* Reports from the client's beacon table cost no airtime */
+			si->scan_data.state++;
+			if (usteer_sta_supports_beacon_measurement_mode(si->sta, BEACON_MEASUREMENT_TABLE) &&
+			    usteer_scan_sm_request(si, usteer_scan_band_stale(si, false),
+						   BEACON_MEASUREMENT_TABLE, 81, 0))
+				break;
+		case SCAN_TABLE_5_GHZ:
+			si->scan_data.state++;
+			if (usteer_sta_supports_beacon_measurement_mode(si->sta, BEACON_MEASUREMENT_TABLE) &&
+			    usteer_scan_sm_request(si, usteer_scan_band_stale(si, true),
+						   BEACON_MEASUREMENT_TABLE, 115, 0))
+				break;
 		case SCAN_ACTIVE_2_GHZ:
-			usteer_ubus_send_beacon_request(si, BEACON_MEASUREMENT_ACTIVE, 81, 0);
 			si->scan_data.state++;
-			si->scan_data.event = current_time;
-			break;
+			if (usteer_scan_sm_request(si, usteer_scan_band_stale(si, false),
+						   BEACON_MEASUREMENT_ACTIVE, 81, 0))
+				break;
 		case SCAN_ACTIVE_5_GHZ:
-			usteer_ubus_send_beacon_request(si, BEACON_MEASUREMENT_ACTIVE, 115, 0);
 			si->scan_data.state++;
-			si->scan_data.event = current_time;
-			break;
+			if (usteer_scan_sm_request(si, usteer_scan_band_stale(si, true),
+						   BEACON_MEASUREMENT_ACTIVE, 115, 0))
+				break;
 		case SCAN_PASSIVE_5_GHZ:
-			/* Perform a passive scan on 5GHz. Scan the channels of the 5 most active 5GHz nodes. */
+			/* Perform a passive scan on the channels of the 5 most active nodes without fresh reports */
 			for (i = 0; i <= si->scan_data.last_passive_scan_idx; i++) {
 				n = usteer_node_get_next_neighbor(si->node, n);
 				if (!n)
 					break;
 			}
 
-			if (n)
-				usteer_ubus_send_beacon_request(si, BEACON_MEASUREMENT_PASSIVE, n->op_class, n->channel);
-
-			si->scan_data.last_passive_scan_idx++;
+			while (n && si->scan_data.last_passive_scan_idx < max_passive_nodes &&
+			       !usteer_scan_node_stale(si, n)) {
+				si->scan_data.skipped++;
+				si->scan_data.last_passive_scan_idx++;
+				n = usteer_node_get_next_neighbor(si->node, n);
+			}
 
-			/* Event on every scan (Tracked by scan interval) */
-			si->scan_data.event = current_time;
+			if (n && si->scan_data.last_passive_scan_idx < max_passive_nodes) {
+				si->scan_data.last_passive_scan_idx++;
+				if (usteer_scan_sm_request(si, true, BEACON_MEASUREMENT_PASSIVE,
+							   n->op_class, n->channel))
+					break;
+			}
 
-			/* Next state if all nodes scanned */
-			if (!n || si->scan_data.last_passive_scan_idx >= max_passive_nodes)
-				si->scan_data.state++;
-			break;
+			si->scan_data.state++;
 		case SCAN_PASSIVE_CURRENT:
 			/* Acquire own neighbor report */
-			usteer_ubus_send_beacon_request(si, BEACON_MEASUREMENT_PASSIVE, si->node->op_class, si->node->channel);
-			si->scan_data.event = current_time;
 			si->scan_data.state++;
-			break;
+			if (usteer_scan_sm_request(si, usteer_scan_node_stale(si, si->node),
+						   BEACON_MEASUREMENT_PASSIVE,
+						   si->node->op_class, si->node->channel))
+				break;
 		case SCAN_DONE:
 			/* Clear all requests & enter IDLE state */
 			usteer_scan_sm_request_source_clear(si);
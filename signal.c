@@ -0,0 +1,153 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#include <string.h>
+
+#include "signal.h"
+
+static int64_t
+usteer_div_round(int64_t a, int64_t b)
+{
+	if ((a < 0) != (b < 0))
+		return (a - b / 2) / b;
+
+	return (a + b / 2) / b;
+}
+
+static void
+usteer_signal_history_sum(struct usteer_signal_history *h, int64_t t, int64_t s, int sign)
+{
+	h->n += sign;
+	h->sum += sign * s;
+	h->sum_sq += sign * s * s;
+	h->sum_t += sign * t;
+	h->sum_t_sq += sign * t * t;
+	h->sum_ts += sign * t * s;
+}
+
+/* Move the time origin forward by d, keeping the sums consistent */
+static void
+usteer_signal_history_shift(struct usteer_signal_history *h, int64_t d)
+{
+	h->sum_t_sq += h->n * d * d - 2 * d * h->sum_t;
+	h->sum_t -= h->n * d;
+	h->sum_ts -= d * h->sum;
+	h->base += d;
+}
+
+void
+usteer_signal_history_add(struct usteer_signal_history *h, uint64_t time, int signal)
+{
+	unsigned int last = (h->idx + USTEER_SIGNAL_HISTORY - 1) % USTEER_SIGNAL_HISTORY;
+	unsigned int oldest;
+	uint32_t t;
+
+	if (h->n && (uint32_t) time - h->time[last] > USTEER_SIGNAL_HISTORY_MAX_AGE)
+		h->n = 0;
+
+	if (h->n == USTEER_SIGNAL_HISTORY) {
+		t = h->time[h->idx] - (uint32_t) h->base;
+		usteer_signal_history_sum(h, t, h->signal[h->idx], -1);
+	}
+
+	if (!h->n) {
+		memset(h, 0, sizeof(*h));
+		h->base = time;
+	} else {
+		/* Keep the time values small */
+		oldest = (h->idx + USTEER_SIGNAL_HISTORY - h->n) % USTEER_SIGNAL_HISTORY;
+		t = h->time[oldest] - (uint32_t) h->base;
+		if (t)
+			usteer_signal_history_shift(h, t);
+	}
+
+	h->time[h->idx] = time;
+	h->signal[h->idx] = signal;
+	h->idx = (h->idx + 1) % USTEER_SIGNAL_HISTORY;
+	usteer_signal_history_sum(h, time - h->base, signal, 1);
+}
+
+int
+usteer_signal_history_mean(struct usteer_signal_history *h)
+{
+	if (!h->n)
+		return 0;
+
+	return usteer_div_round(h->sum, h->n);
+}
+
+/* In dB^2 */
+int
+usteer_signal_history_variance(struct usteer_signal_history *h)
+{
+	if (!h->n)
+		return 0;
+
+	return usteer_div_round(h->n * h->sum_sq - h->sum * h->sum, h->n * h->n);
+}
+
+/* Time between the oldest and the newest sample in ms */
+uint32_t
+usteer_signal_history_span(struct usteer_signal_history *h)
+{
+	unsigned int last = (h->idx + USTEER_SIGNAL_HISTORY - 1) % USTEER_SIGNAL_HISTORY;
+	unsigned int oldest = (h->idx + USTEER_SIGNAL_HISTORY - h->n) % USTEER_SIGNAL_HISTORY;
+
+	if (!h->n)
+		return 0;
+
+	return h->time[last] - h->time[oldest];
+}
+
+/* Least squares slope in mdB/s */
+int
+usteer_signal_history_slope(struct usteer_signal_history *h)
+{
+	int64_t den;
+
+	if (h->n < 2)
+		return 0;
+
+	den = h->n * h->sum_t_sq - h->sum_t * h->sum_t;
+	if (!den)
+		return 0;
+
+	return usteer_div_round((h->n * h->sum_ts - h->sum_t * h->sum) * 1000 * 1000, den);
+}
+
+/*
+ * Signal to compare against a threshold, extrapolated by the horizon (ms) if
+ * the trend is falling. Returns the signal unchanged while there are too few
+ * samples or they are too close together for the slope to be meaningful.
+ */
+int
+usteer_signal_history_predict(struct usteer_signal_history *h, int signal, uint32_t horizon)
+{
+	int slope;
+
+	if (!horizon || h->n < USTEER_SIGNAL_PREDICT_MIN_SAMPLES ||
+	    usteer_signal_history_span(h) < USTEER_SIGNAL_PREDICT_MIN_SPAN)
+		return signal;
+
+	slope = usteer_signal_history_slope(h);
+	if (slope >= 0)
+		return signal;
+
+	return signal + (int64_t) slope * horizon / (1000 * 1000);
+}
@@ -0,0 +1,53 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *   Copyright (C) 2020 embedd.ch 
+ *   Copyright (C) 2020 Felix Fietkau <nbd@nbd.name> 
+ *   Copyright (C) 2020 John Crispin <john@phrozen.org> 
+ */
+
+#ifndef __APMGR_SIGNAL_H
+#define __APMGR_SIGNAL_H
+
+#include <stdint.h>
+
+#define USTEER_SIGNAL_HISTORY		8
+/* Samples older than this relative to a new one are discarded */
+#define USTEER_SIGNAL_HISTORY_MAX_AGE	(5 * 60 * 1000)
+
+/* Minimum number of samples and time they span before the trend is trusted */
+#define USTEER_SIGNAL_PREDICT_MIN_SAMPLES	(USTEER_SIGNAL_HISTORY / 2)
+#define USTEER_SIGNAL_PREDICT_MIN_SPAN		(3 * 1000)
+
+/* Recent signal samples, with running sums for O(1) mean, variance and slope */
+struct usteer_signal_history {
+	/* Time origin of the sums, sample times are its lower 32 bits */
+	uint64_t base;
+	uint32_t time[USTEER_SIGNAL_HISTORY];
+	int8_t signal[USTEER_SIGNAL_HISTORY];
+	uint8_t idx;
+	uint8_t n;
+
+	int64_t sum, sum_sq;
+	int64_t sum_t, sum_t_sq, sum_ts;
+};
+
+void usteer_signal_history_add(struct usteer_signal_history *h, uint64_t time, int signal);
+int usteer_signal_history_mean(struct usteer_signal_history *h);
+int usteer_signal_history_variance(struct usteer_signal_history *h);
+int usteer_signal_history_slope(struct usteer_signal_history *h);
+uint32_t usteer_signal_history_span(struct usteer_signal_history *h);
+int usteer_signal_history_predict(struct usteer_signal_history *h, int signal, uint32_t horizon);
+
+#endif
@@ -39,7 +39,7 @@ usteer_sta_del(struct sta *sta)
 	free(sta);
 }
 
-static void
+void
 usteer_sta_info_del(struct sta_info *si)
 {
 	struct sta *sta = si->sta;
@@ -50,12 +50,23 @@ usteer_sta_info_del(struct sta_info *si)
 	usteer_timeout_cancel(&tq, &si->timeout);
 	list_del(&si->list);
 	list_del(&si->node_list);
+	free(si->btm.nr);
 	free(si);
 
 	if (list_empty(&sta->nodes))
 		usteer_sta_del(sta);
 }
 
+/* Mark the BSS transition neighbor lists of a station for recomputation */
+void
+usteer_sta_btm_invalidate(struct sta *sta)
+{
+	struct sta_info *si;
+
+	list_for_each_entry(si, &sta->nodes, list)
+		si->btm.stale = true;
+}
+
 void
 usteer_sta_node_cleanup(struct usteer_node *node)
 {
@@ -149,9 +160,20 @@ usteer_sta_get(const uint8_t *addr, bool create)
 void usteer_sta_disconnected(struct sta_info *si)
 {
 	si->connected = STA_NOT_CONNECTED;
+	si->roam_predict_until = 0;
 	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
 }
 
+/* Signal used for policy thresholds */
+int
+usteer_sta_info_signal(struct sta_info *si)
+{
+	if (config.signal_smoothing && si->signal_history.n)
+		return usteer_signal_history_mean(&si->signal_history);
+
+	return si->signal;
+}
+
 void
 usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 {
@@ -159,8 +181,11 @@ usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 	if (si->connected == STA_CONNECTED && si->signal != NO_SIGNAL && !avg)
 		signal = NO_SIGNAL;
 
-	if (signal != NO_SIGNAL)
+	if (signal != NO_SIGNAL) {
 		si->signal = signal;
+		usteer_signal_history_add(&si->signal_history, current_time, signal);
+		usteer_policy_signal_update(si);
+	}
 
 	si->seen = current_time;
 
@@ -19,17 +19,64 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <net/ethernet.h>
-#ifdef linux
-#include <netinet/ether.h>
-#endif
 
 #include "usteer.h"
 #include "node.h"
 #include "event.h"
 
+#define USTEER_CMD_MAX_PENDING	4
+#define USTEER_CMD_MAX_QUEUED	64
+#define USTEER_CMD_TIMEOUT	1000
+
+/* Target size of a single reply when dumping in chunks */
+#define USTEER_DUMP_CHUNK_SIZE	(32 * 1024)
+
+struct usteer_ubus_cmd {
+	struct list_head list;
+	struct usteer_local_node *ln;
+
+	struct ubus_request req;
+	struct uloop_timeout timeout;
+
+	const char *method;
+	uint8_t sta_addr[6];
+	uint64_t queued;
+
+	/* Arrival of the BSS transition query this command answers */
+	uint64_t query_time;
+
+	struct blob_attr msg[];
+};
+
+struct usteer_ubus_dump {
+	struct ubus_context *ctx;
+	struct ubus_request_data req;
+	struct uloop_timeout timeout;
+	struct blob_buf buf;
+
+	/* Returns true once the last element has been added */
+	bool (*fill)(struct usteer_ubus_dump *dump, struct blob_buf *buf, size_t limit);
+	bool compact;
+
+	/* Key of the element to resume after */
+	bool started;
+	uint8_t addr[6];
+	uint32_t id;
+	char *name;
+};
+
+enum {
+	DUMP_ATTR_CHUNKED,
+	DUMP_ATTR_COMPACT,
+	__DUMP_ATTR_MAX
+};
+
+static const struct blobmsg_policy dump_policy[__DUMP_ATTR_MAX] = {
+	[DUMP_ATTR_CHUNKED] = { "chunked", BLOBMSG_TYPE_BOOL },
+	[DUMP_ATTR_COMPACT] = { "compact", BLOBMSG_TYPE_BOOL },
+};
+
 static struct blob_buf b;
-static KVLIST(host_info, kvlist_blob_len);
 
 static void *
 blobmsg_open_table_mac(struct blob_buf *buf, uint8_t *addr)
@@ -39,28 +86,146 @@ blobmsg_open_table_mac(struct blob_buf *buf, uint8_t *addr)
 	return blobmsg_open_table(buf, str);
 }
 
+static uint64_t
+usteer_mac_to_u64(const uint8_t *addr)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		val = (val << 8) | addr[i];
+
+	return val;
+}
+
+static void
+usteer_ubus_dump_free(struct usteer_ubus_dump *dump)
+{
+	blob_buf_free(&dump->buf);
+	free(dump->name);
+	free(dump);
+}
+
+static void
+usteer_ubus_dump_cb(struct uloop_timeout *t)
+{
+	struct usteer_ubus_dump *dump = container_of(t, struct usteer_ubus_dump, timeout);
+	bool done;
+
+	blob_buf_init(&dump->buf, 0);
+	done = dump->fill(dump, &dump->buf, USTEER_DUMP_CHUNK_SIZE);
+	ubus_send_reply(dump->ctx, &dump->req, dump->buf.head);
+
+	if (!done) {
+		/* Let other events run before the next chunk */
+		uloop_timeout_set(t, 1);
+		return;
+	}
+
+	ubus_complete_deferred_request(dump->ctx, &dump->req, 0);
+	usteer_ubus_dump_free(dump);
+}
+
+/*
+ * Dump elements with fill, either in a single reply or, if requested,
+ * as a series of replies of bounded size sent from the event loop.
+ */
 static int
-usteer_ubus_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
-		       struct ubus_request_data *req, const char *method,
-		       struct blob_attr *msg)
+usteer_ubus_dump(struct ubus_context *ctx, struct ubus_request_data *req,
+		 struct blob_attr *msg,
+		 bool (*fill)(struct usteer_ubus_dump *dump, struct blob_buf *buf, size_t limit))
+{
+	struct blob_attr *tb[__DUMP_ATTR_MAX];
+	struct usteer_ubus_dump *dump;
+	struct usteer_ubus_dump tmp = {
+		.fill = fill,
+	};
+
+	blobmsg_parse(dump_policy, __DUMP_ATTR_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[DUMP_ATTR_COMPACT])
+		tmp.compact = blobmsg_get_bool(tb[DUMP_ATTR_COMPACT]);
+
+	if (!tb[DUMP_ATTR_CHUNKED] || !blobmsg_get_bool(tb[DUMP_ATTR_CHUNKED])) {
+		blob_buf_init(&b, 0);
+		fill(&tmp, &b, 0);
+		ubus_send_reply(ctx, req, b.head);
+		free(tmp.name);
+		return 0;
+	}
+
+	dump = calloc(1, sizeof(*dump));
+	if (!dump)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	*dump = tmp;
+	dump->ctx = ctx;
+	dump->timeout.cb = usteer_ubus_dump_cb;
+	ubus_defer_request(ctx, req, &dump->req);
+	uloop_timeout_set(&dump->timeout, 1);
+
+	return 0;
+}
+
+static struct sta *
+usteer_ubus_dump_next_sta(struct sta *sta)
+{
+	if (avl_is_last(&stations, &sta->avl))
+		return NULL;
+
+	return avl_next_element(sta, avl);
+}
+
+static bool
+usteer_ubus_dump_clients(struct usteer_ubus_dump *dump, struct blob_buf *buf, size_t limit)
 {
 	struct sta_info *si;
 	struct sta *sta;
-	void *_s, *_cur_n;
+	void *a = NULL, *_s, *_cur_n;
+
+	sta = avl_find_ge_element(&stations, dump->addr, sta, avl);
+	if (sta && dump->started && !memcmp(sta->addr, dump->addr, 6))
+		sta = usteer_ubus_dump_next_sta(sta);
+
+	if (dump->compact)
+		a = blobmsg_open_array(buf, "clients");
+
+	while (sta) {
+		if (dump->compact) {
+			_s = blobmsg_open_table(buf, NULL);
+			blobmsg_add_u64(buf, "addr", usteer_mac_to_u64(sta->addr));
+		} else {
+			_s = blobmsg_open_table_mac(buf, sta->addr);
+		}
 
-	blob_buf_init(&b, 0);
-	avl_for_each_element(&stations, sta, avl) {
-		_s = blobmsg_open_table_mac(&b, sta->addr);
 		list_for_each_entry(si, &sta->nodes, list) {
-			_cur_n = blobmsg_open_table(&b, usteer_node_name(si->node));
-			blobmsg_add_u8(&b, "connected", si->connected);
-			blobmsg_add_u32(&b, "signal", si->signal);
-			blobmsg_close_table(&b, _cur_n);
+			_cur_n = blobmsg_open_table(buf, usteer_node_name(si->node));
+			blobmsg_add_u8(buf, "connected", si->connected);
+			blobmsg_add_u32(buf, "signal", si->signal);
+			blobmsg_close_table(buf, _cur_n);
 		}
-		blobmsg_close_table(&b, _s);
+		blobmsg_close_table(buf, _s);
+
+		memcpy(dump->addr, sta->addr, 6);
+		dump->started = true;
+
+		sta = usteer_ubus_dump_next_sta(sta);
+		if (limit && blob_len(buf->head) >= limit)
+			break;
 	}
-	ubus_send_reply(ctx, req, b.head);
-	return 0;
+
+	if (a)
+		blobmsg_close_array(buf, a);
+
+	return !sta;
+}
+
+static int
+usteer_ubus_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	return usteer_ubus_dump(ctx, req, msg, usteer_ubus_dump_clients);
 }
 
 static struct blobmsg_policy client_arg[] = {
@@ -79,15 +244,32 @@ usteer_ubus_add_stats(struct sta_info_stats *stats, const char *name)
 	blobmsg_close_table(&b, s);
 }
 
+static void
+usteer_ubus_add_signal_history(const char *name, struct usteer_signal_history *h)
+{
+	void *c;
+
+	if (!h->n)
+		return;
+
+	c = blobmsg_open_table(&b, name);
+	blobmsg_add_u32(&b, "samples", h->n);
+	blobmsg_add_u32(&b, "mean", usteer_signal_history_mean(h));
+	blobmsg_add_u32(&b, "variance", usteer_signal_history_variance(h));
+	blobmsg_add_u32(&b, "slope", usteer_signal_history_slope(h));
+	blobmsg_close_table(&b, c);
+}
+
 static int
 usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 			   struct ubus_request_data *req, const char *method,
 			   struct blob_attr *msg)
 {
+	struct usteer_measurement_report *mr;
 	struct sta_info *si;
 	struct sta *sta;
 	struct blob_attr *mac_str;
-	uint8_t *mac;
+	uint8_t mac[6];
 	void *_n, *_cur_n, *_s;
 	int i;
 
@@ -95,8 +277,7 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 	if (!mac_str)
 		return UBUS_STATUS_INVALID_ARGUMENT;
 
-	mac = (uint8_t *) ether_aton(blobmsg_data(mac_str));
-	if (!mac)
+	if (!usteer_parse_mac(blobmsg_data(mac_str), mac))
 		return UBUS_STATUS_INVALID_ARGUMENT;
 
 	sta = usteer_sta_get(mac, false);
@@ -111,6 +292,14 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 		_cur_n = blobmsg_open_table(&b, usteer_node_name(si->node));
 		blobmsg_add_u8(&b, "connected", si->connected);
 		blobmsg_add_u32(&b, "signal", si->signal);
+		usteer_ubus_add_signal_history("signal_history", &si->signal_history);
+		if (si->last_cmd.method) {
+			_s = blobmsg_open_table(&b, "last_command");
+			blobmsg_add_string(&b, "method", si->last_cmd.method);
+			blobmsg_add_u32(&b, "status", si->last_cmd.status);
+			blobmsg_add_u64(&b, "age", current_time - si->last_cmd.timestamp);
+			blobmsg_close_table(&b, _s);
+		}
 		_s = blobmsg_open_table(&b, "stats");
 		for (i = 0; i < __EVENT_TYPE_MAX; i++)
 			usteer_ubus_add_stats(&si->stats[EVENT_TYPE_PROBE], event_types[i]);
@@ -119,6 +308,17 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 	}
 	blobmsg_close_table(&b, _n);
 
+	_n = blobmsg_open_table(&b, "measurements");
+	list_for_each_entry(mr, &sta->measurements, sta_list) {
+		_cur_n = blobmsg_open_table(&b, usteer_node_name(mr->node));
+		blobmsg_add_u32(&b, "rcpi", mr->beacon_report.rcpi);
+		blobmsg_add_u32(&b, "rsni", mr->beacon_report.rsni);
+		blobmsg_add_u64(&b, "age", current_time - mr->timestamp);
+		usteer_ubus_add_signal_history("signal_history", &mr->signal);
+		blobmsg_close_table(&b, _cur_n);
+	}
+	blobmsg_close_table(&b, _n);
+
 	ubus_send_reply(ctx, req, b.head);
 
 	return 0;
@@ -149,9 +349,11 @@ struct cfg_item {
 	_cfg(BOOL, syslog), \
 	_cfg(U32, debug_level), \
 	_cfg(BOOL, ipv6), \
+	_cfg(BOOL, aggregator), \
 	_cfg(U32, sta_block_timeout), \
 	_cfg(U32, local_sta_timeout), \
 	_cfg(U32, local_sta_update), \
+	_cfg(U32, local_sta_reconcile_interval), \
 	_cfg(U32, max_neighbor_reports), \
 	_cfg(U32, max_retry_band), \
 	_cfg(U32, seen_policy_timeout), \
@@ -161,7 +363,10 @@ struct cfg_item {
 	_cfg(U32, band_steering_threshold), \
 	_cfg(U32, remote_update_interval), \
 	_cfg(U32, remote_node_timeout), \
+	_cfg(U32, remote_timeout), \
+	_cfg(U32, remote_full_update_interval), \
 	_cfg(BOOL, assoc_steering), \
+	_cfg(BOOL, signal_smoothing), \
 	_cfg(I32, min_connect_snr), \
 	_cfg(I32, min_snr), \
 	_cfg(U32, min_snr_kick_delay), \
@@ -172,6 +377,7 @@ struct cfg_item {
 	_cfg(U32, roam_scan_interval), \
 	_cfg(I32, roam_trigger_snr), \
 	_cfg(U32, roam_trigger_interval), \
+	_cfg(U32, roam_predict_horizon), \
 	_cfg(U32, roam_kick_delay), \
 	_cfg(U32, signal_diff_threshold), \
 	_cfg(U32, initial_connect_delay), \
@@ -181,6 +387,7 @@ struct cfg_item {
 	_cfg(U32, load_kick_min_clients), \
 	_cfg(U32, load_kick_reason_code), \
 	_cfg(ARRAY_CB, interfaces), \
+	_cfg(ARRAY_CB, peers), \
 	_cfg(STRING_CB, node_up_script), \
 	_cfg(ARRAY_CB, event_log_types), \
 	_cfg(ARRAY_CB, ssid_list)
@@ -250,6 +457,7 @@ usteer_ubus_set_config(struct ubus_context *ctx, struct ubus_object *obj,
 		      struct blob_attr *msg)
 {
 	struct blob_attr *tb[__CFG_MAX];
+	struct usteer_local_node *ln;
 	int i;
 
 	if (!strcmp(method, "set_config"))
@@ -280,9 +488,131 @@ usteer_ubus_set_config(struct ubus_context *ctx, struct ubus_object *obj,
 
 	usteer_interface_init();
 
+	/* Thresholds may have changed */
+	avl_for_each_element(&local_nodes, ln, node.avl)
+		ln->signal_check = true;
+
 	return 0;
 }
 
+static void
+usteer_dump_survey_cb(void *priv, struct usteer_survey_data *d)
+{
+	struct blob_buf *buf = priv;
+	void *c;
+
+	c = blobmsg_open_table(buf, NULL);
+	blobmsg_add_u32(buf, "freq", d->freq);
+	blobmsg_add_u32(buf, "noise", d->noise);
+	blobmsg_add_u32(buf, "load", d->load);
+	blobmsg_add_u32(buf, "load_peak", d->load_peak);
+	blobmsg_close_table(buf, c);
+}
+
+struct usteer_dump_freqlist {
+	struct blob_buf *buf;
+	unsigned int bands;
+};
+
+enum {
+	DUMP_BAND_2G,
+	DUMP_BAND_5G,
+	DUMP_BAND_6G,
+	DUMP_BAND_60G,
+	__DUMP_BAND_MAX
+};
+
+static const char * const dump_bands[__DUMP_BAND_MAX] = {
+	[DUMP_BAND_2G] = "2g",
+	[DUMP_BAND_5G] = "5g",
+	[DUMP_BAND_6G] = "6g",
+	[DUMP_BAND_60G] = "60g",
+};
+
+static void
+usteer_dump_freqlist_cb(void *priv, struct usteer_freq_data *f)
+{
+	struct usteer_dump_freqlist *d = priv;
+	void *c;
+
+	if (f->freq < 2500)
+		d->bands |= 1 << DUMP_BAND_2G;
+	else if (f->freq < 5950)
+		d->bands |= 1 << DUMP_BAND_5G;
+	else if (f->freq < 7200)
+		d->bands |= 1 << DUMP_BAND_6G;
+	else
+		d->bands |= 1 << DUMP_BAND_60G;
+
+	c = blobmsg_open_table(d->buf, NULL);
+	blobmsg_add_u32(d->buf, "freq", f->freq);
+	blobmsg_add_u32(d->buf, "txpower", f->txpower);
+	blobmsg_add_u8(d->buf, "dfs", f->dfs);
+	if (f->unavailable)
+		blobmsg_add_u8(d->buf, "unavailable", true);
+	blobmsg_close_table(d->buf, c);
+}
+
+static void
+usteer_dump_freqlist(struct blob_buf *buf, struct usteer_local_node *ln)
+{
+	struct usteer_dump_freqlist d = { .buf = buf };
+	struct usteer_node_handler *h;
+	void *c;
+	int i;
+
+	c = blobmsg_open_array(buf, "freqlist");
+	list_for_each_entry(h, &node_handlers, list) {
+		if (h->get_freqlist)
+			h->get_freqlist(&ln->node, &d, usteer_dump_freqlist_cb);
+	}
+	blobmsg_close_array(buf, c);
+
+	c = blobmsg_open_array(buf, "bands");
+	for (i = 0; i < __DUMP_BAND_MAX; i++)
+		if (d.bands & (1 << i))
+			blobmsg_add_string(buf, NULL, dump_bands[i]);
+	blobmsg_close_array(buf, c);
+}
+
+static void
+usteer_dump_local_node(struct blob_buf *buf, struct usteer_local_node *ln)
+{
+	uint32_t n_done = ln->cmd.completed + ln->cmd.failed;
+	struct usteer_node_handler *h;
+	void *c;
+
+	blobmsg_add_u32(buf, "startup_time", ln->startup_time);
+
+	c = blobmsg_open_table(buf, "commands");
+	blobmsg_add_u32(buf, "queued", ln->cmd.n_queued);
+	blobmsg_add_u32(buf, "pending", ln->cmd.n_pending);
+	blobmsg_add_u32(buf, "max_queued", ln->cmd.max_queued);
+	blobmsg_add_u32(buf, "completed", ln->cmd.completed);
+	blobmsg_add_u32(buf, "failed", ln->cmd.failed);
+	blobmsg_add_u32(buf, "dropped", ln->cmd.dropped);
+	blobmsg_add_u32(buf, "latency_avg", n_done ? ln->cmd.latency_total / n_done : 0);
+	blobmsg_add_u32(buf, "latency_max", ln->cmd.latency_max);
+	blobmsg_close_table(buf, c);
+
+	c = blobmsg_open_table(buf, "bss_tm_queries");
+	blobmsg_add_u32(buf, "queries", ln->bss_tm.queries);
+	blobmsg_add_u32(buf, "cache_hits", ln->bss_tm.cache_hits);
+	blobmsg_add_u32(buf, "latency_p50", usteer_latency_hist_percentile(&ln->bss_tm.latency, 50));
+	blobmsg_add_u32(buf, "latency_p90", usteer_latency_hist_percentile(&ln->bss_tm.latency, 90));
+	blobmsg_add_u32(buf, "latency_p99", usteer_latency_hist_percentile(&ln->bss_tm.latency, 99));
+	blobmsg_close_table(buf, c);
+
+	c = blobmsg_open_array(buf, "survey");
+	list_for_each_entry(h, &node_handlers, list) {
+		if (h->get_survey)
+			h->get_survey(&ln->node, buf, usteer_dump_survey_cb);
+	}
+	blobmsg_close_array(buf, c);
+
+	usteer_dump_freqlist(buf, ln);
+}
+
 void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node)
 {
 	void *c, *roam_events;
@@ -311,6 +641,9 @@ void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node)
 				  blob_data(node->node_info),
 				  blob_len(node->node_info));
 
+	if (node->type == NODE_TYPE_LOCAL)
+		usteer_dump_local_node(buf, container_of(node, struct usteer_local_node, node));
+
 	blobmsg_close_table(buf, c);
 }
 
@@ -327,21 +660,50 @@ void usteer_dump_host(struct blob_buf *buf, struct usteer_remote_host *host)
 	blobmsg_close_table(buf, c);
 }
 
-static int
-usteer_ubus_local_info(struct ubus_context *ctx, struct ubus_object *obj,
-		      struct ubus_request_data *req, const char *method,
-		      struct blob_attr *msg)
+static struct usteer_local_node *
+usteer_ubus_dump_next_local_node(struct usteer_local_node *ln)
 {
-	struct usteer_node *node;
+	if (avl_is_last(&local_nodes, &ln->node.avl))
+		return NULL;
 
-	blob_buf_init(&b, 0);
+	return avl_next_element(ln, node.avl);
+}
+
+static bool
+usteer_ubus_dump_local_nodes(struct usteer_ubus_dump *dump, struct blob_buf *buf, size_t limit)
+{
+	struct usteer_local_node *ln;
 
-	for_each_local_node(node)
-		usteer_dump_node(&b, node);
+	if (!dump->name)
+		ln = avl_is_empty(&local_nodes) ? NULL :
+		     avl_first_element(&local_nodes, ln, node.avl);
+	else
+		ln = avl_find_ge_element(&local_nodes, dump->name, ln, node.avl);
 
-	ubus_send_reply(ctx, req, b.head);
+	if (ln && dump->name && !strcmp(usteer_node_name(&ln->node), dump->name))
+		ln = usteer_ubus_dump_next_local_node(ln);
 
-	return 0;
+	while (ln) {
+		if (!ln->node.disabled)
+			usteer_dump_node(buf, &ln->node);
+
+		free(dump->name);
+		dump->name = strdup(usteer_node_name(&ln->node));
+
+		ln = usteer_ubus_dump_next_local_node(ln);
+		if (limit && blob_len(buf->head) >= limit)
+			break;
+	}
+
+	return !ln;
+}
+
+static int
+usteer_ubus_local_info(struct ubus_context *ctx, struct ubus_object *obj,
+		      struct ubus_request_data *req, const char *method,
+		      struct blob_attr *msg)
+{
+	return usteer_ubus_dump(ctx, req, msg, usteer_ubus_dump_local_nodes);
 }
 
 static int
@@ -361,21 +723,48 @@ usteer_ubus_remote_hosts(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
-static int
-usteer_ubus_remote_info(struct ubus_context *ctx, struct ubus_object *obj,
-		       struct ubus_request_data *req, const char *method,
-		       struct blob_attr *msg)
+static struct usteer_remote_host *
+usteer_ubus_dump_next_host(struct usteer_remote_host *host)
 {
+	if (avl_is_last(&remote_hosts, &host->avl))
+		return NULL;
+
+	return avl_next_element(host, avl);
+}
+
+/* Remote nodes are dumped per host, so that the host id can serve as cursor */
+static bool
+usteer_ubus_dump_remote_nodes(struct usteer_ubus_dump *dump, struct blob_buf *buf, size_t limit)
+{
+	struct usteer_remote_host *host;
 	struct usteer_remote_node *rn;
+	void *key = (void *)(uintptr_t) dump->id;
 
-	blob_buf_init(&b, 0);
+	host = avl_find_ge_element(&remote_hosts, key, host, avl);
+	if (host && dump->started && host->avl.key == key)
+		host = usteer_ubus_dump_next_host(host);
 
-	for_each_remote_node(rn)
-		usteer_dump_node(&b, &rn->node);
+	while (host) {
+		list_for_each_entry(rn, &host->nodes, host_list)
+			usteer_dump_node(buf, &rn->node);
 
-	ubus_send_reply(ctx, req, b.head);
+		dump->id = (uint32_t)(uintptr_t) host->avl.key;
+		dump->started = true;
 
-	return 0;
+		host = usteer_ubus_dump_next_host(host);
+		if (limit && blob_len(buf->head) >= limit)
+			break;
+	}
+
+	return !host;
+}
+
+static int
+usteer_ubus_remote_info(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	return usteer_ubus_dump(ctx, req, msg, usteer_ubus_dump_remote_nodes);
 }
 
 static int
@@ -404,82 +793,265 @@ usteer_ubus_get_connected_clients_add_better_candidates(struct sta_info *si)
 	return 0;
 }
 
+enum {
+	CLIENTS_SECTION_CANDIDATES,
+	CLIENTS_SECTION_MEASUREMENTS,
+	CLIENTS_SECTION_ROAM,
+	CLIENTS_SECTION_SCAN,
+	__CLIENTS_SECTION_MAX
+};
+
+static const char * const clients_sections[__CLIENTS_SECTION_MAX] = {
+	[CLIENTS_SECTION_CANDIDATES] = "candidates",
+	[CLIENTS_SECTION_MEASUREMENTS] = "measurements",
+	[CLIENTS_SECTION_ROAM] = "roam",
+	[CLIENTS_SECTION_SCAN] = "scan",
+};
+
+/* Candidates are expensive to compute and must be requested explicitly */
+#define CLIENTS_SECTIONS_DEFAULT \
+	((1 << CLIENTS_SECTION_MEASUREMENTS) | \
+	 (1 << CLIENTS_SECTION_ROAM) | \
+	 (1 << CLIENTS_SECTION_SCAN))
+
+enum {
+	CLIENTS_ATTR_SECTIONS,
+	CLIENTS_ATTR_NODE,
+	CLIENTS_ATTR_ADDRESS,
+	CLIENTS_ATTR_CURSOR,
+	CLIENTS_ATTR_LIMIT,
+	__CLIENTS_ATTR_MAX
+};
+
+static const struct blobmsg_policy connected_clients_policy[__CLIENTS_ATTR_MAX] = {
+	[CLIENTS_ATTR_SECTIONS] = { "sections", BLOBMSG_TYPE_ARRAY },
+	[CLIENTS_ATTR_NODE] = { "node", BLOBMSG_TYPE_STRING },
+	[CLIENTS_ATTR_ADDRESS] = { "address", BLOBMSG_TYPE_STRING },
+	[CLIENTS_ATTR_CURSOR] = { "cursor", BLOBMSG_TYPE_TABLE },
+	[CLIENTS_ATTR_LIMIT] = { "limit", BLOBMSG_TYPE_INT32 },
+};
+
+enum {
+	CLIENTS_CURSOR_NODE,
+	CLIENTS_CURSOR_ADDRESS,
+	__CLIENTS_CURSOR_MAX
+};
+
+static const struct blobmsg_policy connected_clients_cursor_policy[__CLIENTS_CURSOR_MAX] = {
+	[CLIENTS_CURSOR_NODE] = { "node", BLOBMSG_TYPE_STRING },
+	[CLIENTS_CURSOR_ADDRESS] = { "address", BLOBMSG_TYPE_STRING },
+};
+
+static int
+usteer_ubus_parse_sections(struct blob_attr *attr, unsigned int *sections)
+{
+	struct blob_attr *cur;
+	int rem, i;
+
+	if (!attr) {
+		*sections = CLIENTS_SECTIONS_DEFAULT;
+		return 0;
+	}
+
+	if (!blobmsg_check_attr_list(attr, BLOBMSG_TYPE_STRING))
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	*sections = 0;
+	blobmsg_for_each_attr(cur, attr, rem) {
+		for (i = 0; i < __CLIENTS_SECTION_MAX; i++) {
+			if (!strcmp(blobmsg_get_string(cur), clients_sections[i]))
+				break;
+		}
+
+		if (i == __CLIENTS_SECTION_MAX)
+			return UBUS_STATUS_INVALID_ARGUMENT;
+
+		*sections |= 1 << i;
+	}
+
+	return 0;
+}
+
+static void
+usteer_ubus_add_connected_client(struct sta_info *si, unsigned int sections)
+{
+	struct usteer_measurement_report *mr;
+	void *s, *t, *a;
+
+	s = blobmsg_open_table_mac(&b, si->sta->addr);
+	blobmsg_add_u32(&b, "signal", si->signal);
+	blobmsg_add_u64(&b, "created", si->created);
+	blobmsg_add_u64(&b, "seen", si->seen);
+	blobmsg_add_u64(&b, "last_connected", si->last_connected);
+
+	t = blobmsg_open_table(&b, "snr-kick");
+	blobmsg_add_u32(&b, "seen-below", si->below_min_snr);
+	blobmsg_close_table(&b, t);
+
+	t = blobmsg_open_table(&b, "load-kick");
+	blobmsg_add_u32(&b, "count", si->kick_count);
+	blobmsg_close_table(&b, t);
+
+	if (sections & (1 << CLIENTS_SECTION_ROAM)) {
+		t = blobmsg_open_table(&b, "roam-state-machine");
+		blobmsg_add_string(&b, "state", usteer_roam_state_name(si->roam_state));
+		blobmsg_add_u32(&b, "tries", si->roam_tries);
+		blobmsg_add_u64(&b, "event", si->roam_event);
+		blobmsg_add_u64(&b, "kick", si->roam_kick);
+		blobmsg_add_u64(&b, "scan_start", si->roam_scan_start);
+		blobmsg_add_u64(&b, "scan_timeout_start", si->roam_scan_timeout_start);
+		blobmsg_close_table(&b, t);
+	}
+
+	if (sections & (1 << CLIENTS_SECTION_SCAN)) {
+		t = blobmsg_open_table(&b, "scan-state-machine");
+		blobmsg_add_string(&b, "state", usteer_scan_state_name(si->scan_data.state));
+		blobmsg_add_u64(&b, "event", si->scan_data.event);
+		blobmsg_add_u32(&b, "requests", si->scan_data.requests);
+		blobmsg_add_u32(&b, "skipped", si->scan_data.skipped);
+		blobmsg_close_table(&b, t);
+	}
+
+	t = blobmsg_open_table(&b, "bss-transition-response");
+	blobmsg_add_u32(&b, "status-code", si->bss_transition_response.status_code);
+	blobmsg_add_u64(&b, "timestamp", si->bss_transition_response.timestamp);
+	blobmsg_close_table(&b, t);
+
+	t = blobmsg_open_table(&b, "airtime");
+	blobmsg_add_u32(&b, "load-weight", usteer_ewma_get(&si->airtime.load));
+	blobmsg_close_table(&b, t);
+
+	if (sections & (1 << CLIENTS_SECTION_MEASUREMENTS)) {
+		a = blobmsg_open_array(&b, "measurements");
+		list_for_each_entry(mr, &si->sta->measurements, sta_list) {
+			t = blobmsg_open_table(&b, "");
+			blobmsg_add_string(&b, "node", usteer_node_name(mr->node));
+			blobmsg_add_u32(&b, "rcpi", mr->beacon_report.rcpi);
+			blobmsg_add_u32(&b, "rsni", mr->beacon_report.rsni);
+			blobmsg_add_u64(&b, "timestamp", mr->timestamp);
+			blobmsg_close_table(&b, t);
+		}
+		blobmsg_close_array(&b, a);
+	}
+
+	if (sections & (1 << CLIENTS_SECTION_CANDIDATES))
+		usteer_ubus_get_connected_clients_add_better_candidates(si);
+
+	blobmsg_close_table(&b, s);
+}
+
+static struct sta_info *
+usteer_ubus_sta_info_on_node(struct sta *sta, struct usteer_node *node)
+{
+	struct sta_info *si;
+
+	list_for_each_entry(si, &sta->nodes, list) {
+		if (si->node == node)
+			return si;
+	}
+
+	return NULL;
+}
+
+/*
+ * Clients are dumped by node name and address, so that the last dumped pair
+ * can serve as cursor regardless of clients connecting in between.
+ */
 static int
 usteer_ubus_get_connected_clients(struct ubus_context *ctx, struct ubus_object *obj,
 				  struct ubus_request_data *req, const char *method,
 				  struct blob_attr *msg)
 {
-	struct usteer_measurement_report *mr;
+	struct blob_attr *tb[__CLIENTS_ATTR_MAX];
+	struct blob_attr *tb_cursor[__CLIENTS_CURSOR_MAX];
+	const char *node_name = NULL, *cursor_node = NULL;
+	struct sta_info *si, *last = NULL;
 	struct usteer_node *node;
-	struct sta_info *si;
-	void *n, *s, *t, *a;
+	struct sta *sta;
+	unsigned int sections;
+	uint32_t limit = 0, count = 0;
+	uint8_t addr[6], cursor_addr[6];
+	bool filter_addr = false;
+	void *n, *c;
+	int ret, cmp;
 
-	blob_buf_init(&b, 0);
+	blobmsg_parse(connected_clients_policy, __CLIENTS_ATTR_MAX, tb,
+		      blob_data(msg), blob_len(msg));
 
-	for_each_local_node(node) {
-		n = blobmsg_open_table(&b, usteer_node_name(node));
+	ret = usteer_ubus_parse_sections(tb[CLIENTS_ATTR_SECTIONS], &sections);
+	if (ret)
+		return ret;
 
-		list_for_each_entry(si, &node->sta_info, node_list) {
-			if (si->connected != STA_CONNECTED)
-				continue;
+	if (tb[CLIENTS_ATTR_NODE])
+		node_name = blobmsg_get_string(tb[CLIENTS_ATTR_NODE]);
 
-			s = blobmsg_open_table_mac(&b, si->sta->addr);
-			blobmsg_add_u32(&b, "signal", si->signal);
-			blobmsg_add_u64(&b, "created", si->created);
-			blobmsg_add_u64(&b, "seen", si->seen);
-			blobmsg_add_u64(&b, "last_connected", si->last_connected);
+	if (tb[CLIENTS_ATTR_ADDRESS]) {
+		if (!usteer_parse_mac(blobmsg_get_string(tb[CLIENTS_ATTR_ADDRESS]), addr))
+			return UBUS_STATUS_INVALID_ARGUMENT;
 
-			t = blobmsg_open_table(&b, "snr-kick");
-			blobmsg_add_u32(&b, "seen-below", si->below_min_snr);
-			blobmsg_close_table(&b, t);
+		filter_addr = true;
+	}
 
-			t = blobmsg_open_table(&b, "load-kick");
-			blobmsg_add_u32(&b, "count", si->kick_count);
-			blobmsg_close_table(&b, t);
+	if (tb[CLIENTS_ATTR_CURSOR]) {
+		blobmsg_parse(connected_clients_cursor_policy, __CLIENTS_CURSOR_MAX, tb_cursor,
+			      blobmsg_data(tb[CLIENTS_ATTR_CURSOR]),
+			      blobmsg_data_len(tb[CLIENTS_ATTR_CURSOR]));
 
-			t = blobmsg_open_table(&b, "roam-state-machine");
-			blobmsg_add_string(&b, "state", usteer_roam_state_name(si->roam_state));
-			blobmsg_add_u32(&b, "tries", si->roam_tries);
-			blobmsg_add_u64(&b, "event", si->roam_event);
-			blobmsg_add_u64(&b, "kick", si->roam_kick);
-			blobmsg_add_u64(&b, "scan_start", si->roam_scan_start);
-			blobmsg_add_u64(&b, "scan_timeout_start", si->roam_scan_timeout_start);
-			blobmsg_close_table(&b, t);
+		if (!tb_cursor[CLIENTS_CURSOR_NODE] || !tb_cursor[CLIENTS_CURSOR_ADDRESS] ||
+		    !usteer_parse_mac(blobmsg_get_string(tb_cursor[CLIENTS_CURSOR_ADDRESS]), cursor_addr))
+			return UBUS_STATUS_INVALID_ARGUMENT;
 
-			t = blobmsg_open_table(&b, "scan-state-machine");
-			blobmsg_add_string(&b, "state", usteer_scan_state_name(si->scan_data.state));
-			blobmsg_add_u64(&b, "event", si->scan_data.event);
-			blobmsg_close_table(&b, t);
+		cursor_node = blobmsg_get_string(tb_cursor[CLIENTS_CURSOR_NODE]);
+	}
 
-			t = blobmsg_open_table(&b, "bss-transition-response");
-			blobmsg_add_u32(&b, "status-code", si->bss_transition_response.status_code);
-			blobmsg_add_u64(&b, "timestamp", si->bss_transition_response.timestamp);
-			blobmsg_close_table(&b, t);
+	if (tb[CLIENTS_ATTR_LIMIT])
+		limit = blobmsg_get_u32(tb[CLIENTS_ATTR_LIMIT]);
 
-			t = blobmsg_open_table(&b, "airtime");
-			blobmsg_add_u32(&b, "load-weight", si->airtime.load_weight);
-			blobmsg_close_table(&b, t);
+	blob_buf_init(&b, 0);
 
-			/* Measurements */
-			a = blobmsg_open_array(&b, "measurements");
-			list_for_each_entry(mr, &si->sta->measurements, sta_list) {
-				t = blobmsg_open_table(&b, "");
-				blobmsg_add_string(&b, "node", usteer_node_name(mr->node));
-				blobmsg_add_u32(&b, "rcpi", mr->beacon_report.rcpi);
-				blobmsg_add_u32(&b, "rsni", mr->beacon_report.rsni);
-				blobmsg_add_u64(&b, "timestamp", mr->timestamp);
-				blobmsg_close_table(&b, t);
-			}
-			blobmsg_close_array(&b, a);
+	for_each_local_node(node) {
+		if (node_name && strcmp(usteer_node_name(node), node_name) != 0)
+			continue;
+
+		cmp = cursor_node ? strcmp(usteer_node_name(node), cursor_node) : 1;
+		if (cmp < 0)
+			continue;
+
+		if (!cmp) {
+			sta = avl_find_ge_element(&stations, cursor_addr, sta, avl);
+			if (sta && !memcmp(sta->addr, cursor_addr, 6))
+				sta = usteer_ubus_dump_next_sta(sta);
+		} else {
+			sta = avl_is_empty(&stations) ? NULL :
+			      avl_first_element(&stations, sta, avl);
+		}
 
-			usteer_ubus_get_connected_clients_add_better_candidates(si);
+		n = blobmsg_open_table(&b, usteer_node_name(node));
+		for (; sta; sta = usteer_ubus_dump_next_sta(sta)) {
+			if (filter_addr && memcmp(sta->addr, addr, 6) != 0)
+				continue;
 
-			blobmsg_close_table(&b, s);
-		}
+			si = usteer_ubus_sta_info_on_node(sta, node);
+			if (!si || si->connected != STA_CONNECTED)
+				continue;
 
+			if (limit && count == limit) {
+				blobmsg_close_table(&b, n);
+				c = blobmsg_open_table(&b, "cursor");
+				blobmsg_add_string(&b, "node", usteer_node_name(last->node));
+				blobmsg_printf(&b, "address", MAC_ADDR_FMT, MAC_ADDR_DATA(last->sta->addr));
+				blobmsg_close_table(&b, c);
+				goto out;
+			}
+
+			usteer_ubus_add_connected_client(si, sections);
+			last = si;
+			count++;
+		}
 		blobmsg_close_table(&b, n);
 	}
 
+out:
 	ubus_send_reply(ctx, req, b.head);
 
 	return 0;
@@ -501,37 +1073,22 @@ static const struct blobmsg_policy del_node_data_policy[] = {
 	[NODE_DATA_VALUES] = { "names", BLOBMSG_TYPE_ARRAY },
 };
 
-static void
-usteer_update_kvlist_data(struct kvlist *kv, struct blob_attr *data,
-			  bool delete)
+static bool
+usteer_update_info_blob(struct blob_attr **dest, struct blob_attr *data,
+			bool delete)
 {
 	struct blob_attr *cur;
+	bool changed = false;
 	int rem;
 
 	blobmsg_for_each_attr(cur, data, rem) {
 		if (delete)
-			kvlist_delete(kv, blobmsg_get_string(cur));
+			changed |= usteer_node_blob_del_attr(dest, blobmsg_get_string(cur));
 		else
-			kvlist_set(kv, blobmsg_name(cur), cur);
+			changed |= usteer_node_blob_set_attr(dest, cur);
 	}
-}
 
-static void
-usteer_update_kvlist_blob(struct blob_attr **dest, struct kvlist *kv)
-{
-	struct blob_attr *val;
-	const char *name;
-
-	blob_buf_init(&b, 0);
-	kvlist_for_each(kv, name, val)
-		blobmsg_add_field(&b, blobmsg_type(val), name,
-				  blobmsg_data(val), blobmsg_len(val));
-
-	val = b.head;
-	if (!blobmsg_len(val))
-		val = NULL;
-
-	usteer_node_set_blob(dest, val);
+	return changed;
 }
 
 static int
@@ -563,24 +1120,24 @@ usteer_ubus_update_node_data(struct ubus_context *ctx, struct ubus_object *obj,
 		if (!ln)
 			return UBUS_STATUS_NOT_FOUND;
 
-		usteer_update_kvlist_data(&ln->node_info, val, delete);
-		usteer_update_kvlist_blob(&ln->node.node_info, &ln->node_info);
+		if (usteer_update_info_blob(&ln->node.node_info, val, delete))
+			ln->node.node_info_version++;
 
 		return 0;
 	}
 
-	usteer_update_kvlist_data(&host_info, val, delete);
-	usteer_update_kvlist_blob(&host_info_blob, &host_info);
+	if (usteer_update_info_blob(&host_info_blob, val, delete))
+		host_info_version++;
 
 	return 0;
 }
 
 static const struct ubus_method usteer_methods[] = {
-	UBUS_METHOD_NOARG("local_info", usteer_ubus_local_info),
+	UBUS_METHOD("local_info", usteer_ubus_local_info, dump_policy),
 	UBUS_METHOD_NOARG("remote_hosts", usteer_ubus_remote_hosts),
-	UBUS_METHOD_NOARG("remote_info", usteer_ubus_remote_info),
-	UBUS_METHOD_NOARG("connected_clients", usteer_ubus_get_connected_clients),
-	UBUS_METHOD_NOARG("get_clients", usteer_ubus_get_clients),
+	UBUS_METHOD("remote_info", usteer_ubus_remote_info, dump_policy),
+	UBUS_METHOD("connected_clients", usteer_ubus_get_connected_clients, connected_clients_policy),
+	UBUS_METHOD("get_clients", usteer_ubus_get_clients, dump_policy),
 	UBUS_METHOD("get_client_info", usteer_ubus_get_client_info, client_arg),
 	UBUS_METHOD_NOARG("get_config", usteer_ubus_get_config),
 	UBUS_METHOD("set_config", usteer_ubus_set_config, config_policy),
@@ -599,21 +1156,180 @@ struct ubus_object usteer_obj = {
 	.n_methods = ARRAY_SIZE(usteer_methods),
 };
 
+static void usteer_ubus_cmd_run(struct usteer_local_node *ln);
+
+static void
+usteer_ubus_cmd_done(struct usteer_ubus_cmd *cmd, int ret)
+{
+	struct usteer_local_node *ln = cmd->ln;
+	struct sta_info *si = NULL;
+	struct sta *sta;
+	uint32_t latency;
+
+	usteer_update_time();
+	latency = current_time - cmd->queued;
+
+	list_del(&cmd->list);
+	uloop_timeout_cancel(&cmd->timeout);
+	ln->cmd.n_pending--;
+
+	if (ret)
+		ln->cmd.failed++;
+	else
+		ln->cmd.completed++;
+	ln->cmd.latency_total += latency;
+	if (latency > ln->cmd.latency_max)
+		ln->cmd.latency_max = latency;
+
+	if (ret)
+		MSG(DEBUG, "%s for " MAC_ADDR_FMT " on %s failed: %s\n",
+		    cmd->method, MAC_ADDR_DATA(cmd->sta_addr),
+		    usteer_node_name(&ln->node), ubus_strerror(ret));
+
+	/* The station entry may have gone away while the command was pending */
+	sta = usteer_sta_get(cmd->sta_addr, false);
+	if (sta)
+		si = usteer_sta_info_get(sta, &ln->node, NULL);
+	if (si) {
+		si->last_cmd.method = cmd->method;
+		si->last_cmd.status = ret;
+		si->last_cmd.timestamp = current_time;
+	}
+
+	if (cmd->query_time)
+		usteer_latency_hist_add(&ln->bss_tm.latency, current_time - cmd->query_time);
+
+	free(cmd);
+	usteer_ubus_cmd_run(ln);
+}
+
+static void
+usteer_ubus_cmd_complete_cb(struct ubus_request *req, int ret)
+{
+	struct usteer_ubus_cmd *cmd = container_of(req, struct usteer_ubus_cmd, req);
+
+	usteer_ubus_cmd_done(cmd, ret);
+}
+
+static void
+usteer_ubus_cmd_timeout_cb(struct uloop_timeout *t)
+{
+	struct usteer_ubus_cmd *cmd = container_of(t, struct usteer_ubus_cmd, timeout);
+
+	ubus_abort_request(ubus_ctx, &cmd->req);
+	usteer_ubus_cmd_done(cmd, UBUS_STATUS_TIMEOUT);
+}
+
+static void
+usteer_ubus_cmd_run(struct usteer_local_node *ln)
+{
+	struct usteer_ubus_cmd *cmd;
+	int ret;
+
+	while (ln->cmd.n_pending < USTEER_CMD_MAX_PENDING &&
+	       !list_empty(&ln->cmd.queue)) {
+		cmd = list_first_entry(&ln->cmd.queue, struct usteer_ubus_cmd, list);
+		list_move_tail(&cmd->list, &ln->cmd.pending);
+		ln->cmd.n_queued--;
+		ln->cmd.n_pending++;
+
+		ret = ubus_invoke_async(ubus_ctx, ln->obj_id, cmd->method, cmd->msg, &cmd->req);
+		if (ret) {
+			usteer_ubus_cmd_done(cmd, ret);
+			return;
+		}
+
+		cmd->req.complete_cb = usteer_ubus_cmd_complete_cb;
+		ubus_complete_request_async(ubus_ctx, &cmd->req);
+
+		cmd->timeout.cb = usteer_ubus_cmd_timeout_cb;
+		uloop_timeout_set(&cmd->timeout, USTEER_CMD_TIMEOUT);
+	}
+}
+
+/* Queue the message in b for the hostapd object of the node */
+static int
+__usteer_ubus_cmd_queue(struct sta_info *si, const char *method, uint64_t query_time)
+{
+	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
+	struct usteer_ubus_cmd *cmd;
+
+	if (ln->cmd.n_queued >= USTEER_CMD_MAX_QUEUED) {
+		MSG(DEBUG, "Command queue of %s full, dropping %s\n",
+		    usteer_node_name(&ln->node), method);
+		ln->cmd.dropped++;
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	cmd = calloc(1, sizeof(*cmd) + blob_pad_len(b.head));
+	if (!cmd)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	cmd->ln = ln;
+	cmd->method = method;
+	cmd->queued = current_time;
+	cmd->query_time = query_time;
+	memcpy(cmd->sta_addr, si->sta->addr, sizeof(cmd->sta_addr));
+	memcpy(cmd->msg, b.head, blob_pad_len(b.head));
+
+	list_add_tail(&cmd->list, &ln->cmd.queue);
+	ln->cmd.n_queued++;
+	if (ln->cmd.n_queued > ln->cmd.max_queued)
+		ln->cmd.max_queued = ln->cmd.n_queued;
+
+	usteer_ubus_cmd_run(ln);
+
+	return 0;
+}
+
+static int
+usteer_ubus_cmd_queue(struct sta_info *si, const char *method)
+{
+	return __usteer_ubus_cmd_queue(si, method, 0);
+}
+
+void usteer_ubus_cmd_init(struct usteer_local_node *ln)
+{
+	INIT_LIST_HEAD(&ln->cmd.queue);
+	INIT_LIST_HEAD(&ln->cmd.pending);
+}
+
+void usteer_ubus_cmd_cleanup(struct usteer_local_node *ln)
+{
+	struct usteer_ubus_cmd *cmd, *tmp;
+
+	list_for_each_entry_safe(cmd, tmp, &ln->cmd.pending, list) {
+		ubus_abort_request(ubus_ctx, &cmd->req);
+		uloop_timeout_cancel(&cmd->timeout);
+		list_del(&cmd->list);
+		free(cmd);
+	}
+
+	list_for_each_entry_safe(cmd, tmp, &ln->cmd.queue, list) {
+		list_del(&cmd->list);
+		free(cmd);
+	}
+
+	ln->cmd.n_queued = 0;
+	ln->cmd.n_pending = 0;
+}
+
 static bool
-usteer_ubus_add_nr_entry(struct usteer_candidate *candidate)
+usteer_ubus_add_nr_entry(struct blob_buf *buf, struct usteer_candidate *candidate)
 {
 	char *rrm_str = usteer_rrm_get_neighbor_report_data_for_candidate(candidate);
 
 	if (!rrm_str)
 		return false;
 
-	blobmsg_add_string(&b, "", rrm_str);
+	blobmsg_add_string(buf, "", rrm_str);
 
 	return true;
 }
 
 static void
-usteer_ubus_disassoc_add_neighbors(struct sta_info *si, enum usteer_reference_node_rating node_ref_pref,
+usteer_ubus_disassoc_add_neighbors(struct blob_buf *buf, struct sta_info *si,
+				   enum usteer_reference_node_rating node_ref_pref,
 				   uint32_t required_criteria, uint64_t max_age)
 {
 	struct usteer_candidate *candidate;
@@ -628,50 +1344,57 @@ usteer_ubus_disassoc_add_neighbors(struct sta_info *si, enum usteer_reference_no
 	if (usteer_candidate_list_len(cl) == 0)
 		usteer_candidate_list_add_for_node(cl, si->node, node_ref_pref);
 
-	c = blobmsg_open_array(&b, "neighbors");
+	c = blobmsg_open_array(buf, "neighbors");
 	for_each_candidate(cl, candidate)
-		usteer_ubus_add_nr_entry(candidate);	
-	blobmsg_close_array(&b, c);
+		usteer_ubus_add_nr_entry(buf, candidate);
+	blobmsg_close_array(buf, c);
 
 	usteer_candidate_list_free(cl);
 }
 
-int usteer_ubus_bss_transition_request(struct sta_info *si,
-				       uint8_t dialog_token,
-				       bool disassoc_imminent,
-				       bool abridged,
-				       uint8_t validity_period)
+void usteer_ubus_btm_nr_refresh(struct sta_info *si)
 {
-	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
+	static struct blob_buf nr_buf;
 
+	blob_buf_init(&nr_buf, 0);
+	usteer_ubus_disassoc_add_neighbors(&nr_buf, si, RN_RATING_REGULAR, 0, 0);
+	usteer_node_set_blob(&si->btm.nr, blob_data(nr_buf.head));
+	si->btm.updated = current_time;
+	si->btm.stale = false;
+}
+
+/* Answer a BSS transition query with the precomputed neighbor list */
+int usteer_ubus_bss_tm_query_response(struct sta_info *si,
+				      uint8_t dialog_token,
+				      uint8_t validity_period,
+				      uint64_t query_time)
+{
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_u32(&b, "dialog_token", dialog_token);
-	blobmsg_add_u8(&b, "disassociation_imminent", disassoc_imminent);
-	blobmsg_add_u8(&b, "abridged", abridged);
+	blobmsg_add_u8(&b, "disassociation_imminent", false);
+	blobmsg_add_u8(&b, "abridged", false);
 	blobmsg_add_u32(&b, "validity_period", validity_period);
-	usteer_ubus_disassoc_add_neighbors(si, RN_RATING_REGULAR, 0, 0);
-	return ubus_invoke(ubus_ctx, ln->obj_id, "bss_transition_request", b.head, NULL, 0, 100);
+	blobmsg_add_field(&b, BLOBMSG_TYPE_ARRAY, "neighbors",
+			  blobmsg_data(si->btm.nr), blobmsg_data_len(si->btm.nr));
+	return __usteer_ubus_cmd_queue(si, "bss_transition_request", query_time);
 }
 
 int usteer_ubus_notify_client_disassoc(struct sta_info *si)
 {
-	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
-
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_u32(&b, "duration", config.roam_kick_delay);
-	usteer_ubus_disassoc_add_neighbors(si, RN_RATING_FORBID, 0, 0);
-	return ubus_invoke(ubus_ctx, ln->obj_id, "wnm_disassoc_imminent", b.head, NULL, 0, 100);
+	usteer_ubus_disassoc_add_neighbors(&b, si, RN_RATING_FORBID, 0, 0);
+	return usteer_ubus_cmd_queue(si, "wnm_disassoc_imminent");
 }
 
 int usteer_ubus_send_beacon_request(struct sta_info *si, enum usteer_beacon_measurement_mode measurement_mode, int op_class, int channel)
 {
-	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
-
-	if (!usteer_sta_supports_beacon_measurement_mode(si->sta, BEACON_MEASUREMENT_ACTIVE)) {
-		MSG(DEBUG, "STA does not support beacon measurement sta=" MAC_ADDR_FMT "\n", MAC_ADDR_DATA(si->sta->addr));
-		return 0;
+	if (!usteer_sta_supports_beacon_measurement_mode(si->sta, measurement_mode)) {
+		MSG(DEBUG, "STA does not support beacon measurement mode %d sta=" MAC_ADDR_FMT "\n",
+		    measurement_mode, MAC_ADDR_DATA(si->sta->addr));
+		return -1;
 	}
 
 	blob_buf_init(&b, 0);
@@ -681,19 +1404,16 @@ int usteer_ubus_send_beacon_request(struct sta_info *si, enum usteer_beacon_meas
 	blobmsg_add_u32(&b, "duration", config.roam_scan_interval / 100);
 	blobmsg_add_u32(&b, "channel", channel);
 	blobmsg_add_u32(&b, "op_class", op_class);
-	return ubus_invoke(ubus_ctx, ln->obj_id, "rrm_beacon_req", b.head, NULL, 0, 100);
-
+	return usteer_ubus_cmd_queue(si, "rrm_beacon_req");
 }
 
 void usteer_ubus_kick_client(struct sta_info *si)
 {
-	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
-
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_u32(&b, "reason", config.load_kick_reason_code);
 	blobmsg_add_u8(&b, "deauth", 1);
-	ubus_invoke(ubus_ctx, ln->obj_id, "del_client", b.head, NULL, 0, 100);
+	usteer_ubus_cmd_queue(si, "del_client");
 	usteer_sta_disconnected(si);
 	si->roam_kick = current_time;
 }
@@ -28,6 +28,7 @@
 #include <libubus.h>
 #include "utils.h"
 #include "timeout.h"
+#include "signal.h"
 
 #define NO_SIGNAL 0xff
 
@@ -79,6 +80,9 @@ struct usteer_node {
 
 	struct blob_attr *rrm_nr;
 	struct blob_attr *node_info;
+	/* Bumped on every change, compared against the last version sent */
+	uint32_t node_info_version;
+	uint32_t node_info_sent;
 	char ssid[33];
 	uint8_t bssid[6];
 
@@ -158,6 +162,10 @@ struct usteer_survey_data {
 
 	uint64_t time;
 	uint64_t time_busy;
+
+	/* Smoothed and recent peak channel busy percentage */
+	uint8_t load;
+	uint8_t load_peak;
 };
 
 struct usteer_freq_data {
@@ -165,6 +173,8 @@ struct usteer_freq_data {
 
 	uint8_t txpower;
 	bool dfs;
+	/* DFS channel blocked after radar detection */
+	bool unavailable;
 };
 
 struct usteer_node_handler {
@@ -174,6 +184,8 @@ struct usteer_node_handler {
 	void (*free_node)(struct usteer_node *);
 	void (*update_node)(struct usteer_node *);
 	void (*update_sta)(struct usteer_node *, struct sta_info *);
+	/* Replaces update_sta with a bulk update of all stations */
+	void (*update_stations)(struct usteer_node *);
 	void (*get_survey)(struct usteer_node *, void *,
 			   void (*cb)(void *priv, struct usteer_survey_data *d));
 	void (*get_freqlist)(struct usteer_node *, void *,
@@ -187,10 +199,12 @@ struct usteer_config {
 	uint32_t debug_level;
 
 	bool ipv6;
+	bool aggregator;
 
 	uint32_t sta_block_timeout;
 	uint32_t local_sta_timeout;
 	uint32_t local_sta_update;
+	uint32_t local_sta_reconcile_interval;
 
 	uint32_t max_retry_band;
 	uint32_t seen_policy_timeout;
@@ -198,6 +212,7 @@ struct usteer_config {
 	uint32_t measurement_policy_timeout;
 
 	bool assoc_steering;
+	bool signal_smoothing;
 
 	uint32_t max_neighbor_reports;
 
@@ -206,6 +221,8 @@ struct usteer_config {
 
 	uint32_t remote_update_interval;
 	uint32_t remote_node_timeout;
+	uint32_t remote_timeout;
+	uint32_t remote_full_update_interval;
 
 	int32_t min_snr;
 	uint32_t min_snr_kick_delay;
@@ -222,6 +239,8 @@ struct usteer_config {
 	int32_t roam_trigger_snr;
 	uint32_t roam_trigger_interval;
 
+	uint32_t roam_predict_horizon;
+
 	uint32_t roam_kick_delay;
 
 	uint32_t initial_connect_delay;
@@ -238,12 +257,24 @@ struct usteer_config {
 	struct blob_attr *ssid_list;
 };
 
+/* Maximum age of the neighbor list sent in response to a BSS transition query */
+#define USTEER_BTM_NR_MAX_AGE	5000
+
 struct usteer_bss_tm_query {
 	struct list_head list;
 
 	/* Can't use sta_info here, as the STA might already be deleted */
 	uint8_t sta_addr[6];
 	uint8_t dialog_token;
+	uint64_t received;
+};
+
+/* Bucket i counts values below 2^i ms, the last one everything above */
+#define USTEER_LATENCY_BUCKETS	16
+
+struct usteer_latency_hist {
+	uint32_t count;
+	uint32_t buckets[USTEER_LATENCY_BUCKETS];
 };
 
 struct sta_info_stats {
@@ -265,6 +296,8 @@ enum roam_trigger_state {
 enum scan_state {
 	SCAN_IDLE,
 	SCAN_START,
+	SCAN_TABLE_2_GHZ,
+	SCAN_TABLE_5_GHZ,
 	SCAN_ACTIVE_2_GHZ,
 	SCAN_ACTIVE_5_GHZ,
 	SCAN_PASSIVE_5_GHZ,
@@ -290,6 +323,7 @@ struct sta_info {
 	uint64_t seen;
 	uint64_t last_connected;
 	int signal;
+	struct usteer_signal_history signal_history;
 
 	enum roam_trigger_state roam_state;
 	uint8_t roam_tries;
@@ -298,13 +332,21 @@ struct sta_info {
 	bool roam_entry;
 	uint64_t roam_scan_start;
 	uint64_t roam_scan_timeout_start;
+	/* A predicted threshold crossing is held until then */
+	uint64_t roam_predict_until;
 
 	struct {
 		enum scan_state state;
 		uint8_t scan_requests;
 		uint64_t event;
+		/* Reports received before the current run are not reused */
+		uint64_t start;
 
 		uint8_t last_passive_scan_idx;
+
+		/* Beacon requests sent and skipped due to fresh reports */
+		uint32_t requests;
+		uint32_t skipped;
 	} scan_data;
 
 	struct {
@@ -314,9 +356,22 @@ struct sta_info {
 
 	struct {
 		uint64_t last_total;
-		uint32_t load_weight;
+		struct usteer_ewma load;
 	} airtime;
 
+	struct {
+		const char *method;
+		int status;
+		uint64_t timestamp;
+	} last_cmd;
+
+	/* Neighbor list to answer BSS transition queries with */
+	struct {
+		struct blob_attr *nr;
+		uint64_t updated;
+		bool stale;
+	} btm;
+
 	int kick_count;
 
 	uint32_t below_min_snr;
@@ -345,17 +400,20 @@ struct usteer_beacon_report {
 struct usteer_measurement_report {
 	struct usteer_timeout timeout;
 
-	struct list_head list;
+	/* Indexed by (sta, node) */
+	struct avl_node avl;
 
 	struct usteer_node *node;
 	struct list_head node_list;
 
+	/* Ordered by timestamp, most recent first */
 	struct sta *sta;
 	struct list_head sta_list;
 
 	uint64_t timestamp;
 
 	struct usteer_beacon_report beacon_report;
+	struct usteer_signal_history signal;
 };
 
 extern struct ubus_context *ubus_ctx;
@@ -366,6 +424,7 @@ extern struct ubus_object usteer_obj;
 extern uint64_t current_time;
 extern const char * const event_types[__EVENT_TYPE_MAX];
 extern struct blob_attr *host_info_blob;
+extern uint32_t host_info_version;
 
 void usteer_update_time(void);
 void usteer_init_defaults(void);
@@ -385,14 +444,16 @@ enum scan_state usteer_scan_sm(struct sta_info *si);
 const char *usteer_scan_state_name(enum scan_state ss);
 
 void usteer_ubus_init(struct ubus_context *ctx);
+void usteer_ubus_cmd_init(struct usteer_local_node *ln);
+void usteer_ubus_cmd_cleanup(struct usteer_local_node *ln);
 void usteer_ubus_kick_client(struct sta_info *si);
 int usteer_ubus_send_beacon_request(struct sta_info *si, enum usteer_beacon_measurement_mode measurement_mode, int op_class, int channel);
 int usteer_ubus_notify_client_disassoc(struct sta_info *si);
-int usteer_ubus_bss_transition_request(struct sta_info *si,
-				       uint8_t dialog_token,
-				       bool disassoc_imminent,
-				       bool abridged,
-				       uint8_t validity_period);
+void usteer_ubus_btm_nr_refresh(struct sta_info *si);
+int usteer_ubus_bss_tm_query_response(struct sta_info *si,
+				      uint8_t dialog_token,
+				      uint8_t validity_period,
+				      uint64_t query_time);
 
 struct sta *usteer_sta_get(const uint8_t *addr, bool create);
 struct sta_info *usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create);
@@ -401,13 +462,18 @@ bool usteer_sta_supports_beacon_measurement_mode(struct sta *sta, enum usteer_be
 
 void usteer_sta_disconnected(struct sta_info *si);
 void usteer_sta_info_update_timeout(struct sta_info *si, int timeout);
+void usteer_sta_info_del(struct sta_info *si);
+void usteer_sta_btm_invalidate(struct sta *sta);
 void usteer_sta_info_update(struct sta_info *si, int signal, bool avg);
+int usteer_sta_info_signal(struct sta_info *si);
 
 static inline const char *usteer_node_name(struct usteer_node *node)
 {
 	return node->avl.key;
 }
-void usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val);
+bool usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val);
+bool usteer_node_blob_set_attr(struct blob_attr **dest, struct blob_attr *val);
+bool usteer_node_blob_del_attr(struct blob_attr **dest, const char *name);
 
 struct usteer_local_node *usteer_local_node_by_bssid(uint8_t *bssid);
 struct usteer_remote_node *usteer_remote_node_by_bssid(uint8_t *bssid);
@@ -425,12 +491,17 @@ bool usteer_policy_node_selectable_by_sta(struct sta_info *si_ref, struct sta_in
 bool usteer_policy_node_selectable_by_sta_measurement(struct usteer_measurement_report *mr_ref,
 						      struct usteer_measurement_report *mr_new, uint64_t max_age);
 bool usteer_policy_load_kick_active(struct usteer_local_node *ln);
+int usteer_policy_signal_threshold(struct usteer_node *node);
+void usteer_policy_signal_update(struct sta_info *si);
 
 const char *usteer_roam_state_name(enum roam_trigger_state rts);
 
 void config_set_interfaces(struct blob_attr *data);
 void config_get_interfaces(struct blob_buf *buf);
 
+void config_set_peers(struct blob_attr *data);
+void config_get_peers(struct blob_buf *buf);
+
 void config_set_node_up_script(struct blob_attr *data);
 void config_get_node_up_script(struct blob_buf *buf);
 
@@ -449,6 +520,9 @@ void usteer_run_hook(const char *name, const char *arg);
 void usteer_dump_node(struct blob_buf *buf, struct usteer_node *node);
 void usteer_dump_host(struct blob_buf *buf, struct usteer_remote_host *host);
 
+void usteer_latency_hist_add(struct usteer_latency_hist *hist, uint32_t val);
+uint32_t usteer_latency_hist_percentile(struct usteer_latency_hist *hist, int pct);
+
 struct usteer_measurement_report * usteer_measurement_report_get(struct sta *sta, struct usteer_node *node, bool create);
 void usteer_measurement_report_node_cleanup(struct usteer_node *node);
 void usteer_measurement_report_sta_cleanup(struct sta *sta);
@@ -456,5 +530,6 @@ void usteer_measurement_report_del(struct usteer_measurement_report *mr);
 
 struct usteer_measurement_report *
 usteer_measurement_report_add_beacon_report(struct sta *sta, struct usteer_node *node, struct usteer_beacon_report *br, uint64_t timestamp);
+int usteer_measurement_report_signal(struct usteer_measurement_report *mr);
 
 #endif
@@ -46,10 +46,45 @@ extern void debug_msg(int level, const char *func, int line, const char *format,
 extern void debug_msg_cont(int level, const char *format, ...);
 
 extern int usteer_load_hex(char *hexstr, char *output, int output_size);
+extern bool usteer_parse_mac(const char *str, uint8_t *addr);
 extern void usteer_dump_hex(char *buf, size_t buf_size, char *output);
 
 int usteer_rcpi_to_rssi(int rcpi);
 
 #define __usteer_init __attribute__((constructor))
 
+/*
+ * Exponentially weighted moving average in Q8 fixed point, avoids soft-float
+ * on targets without FPU. alpha is the weight of a new sample in 1/256 units.
+ */
+#define USTEER_EWMA_SHIFT	8
+#define USTEER_EWMA_ALPHA(_pct)	(((_pct) << USTEER_EWMA_SHIFT) / 100)
+
+struct usteer_ewma {
+	int64_t val;
+	bool valid;
+};
+
+static inline void
+usteer_ewma_add(struct usteer_ewma *e, int64_t sample, unsigned int alpha)
+{
+	sample <<= USTEER_EWMA_SHIFT;
+	if (!e->valid) {
+		e->val = sample;
+		e->valid = true;
+		return;
+	}
+
+	e->val += ((sample - e->val) * (int64_t) alpha) / (1 << USTEER_EWMA_SHIFT);
+}
+
+static inline int64_t
+usteer_ewma_get(const struct usteer_ewma *e)
+{
+	int64_t round = e->val < 0 ? -(1 << (USTEER_EWMA_SHIFT - 1)) :
+				     (1 << (USTEER_EWMA_SHIFT - 1));
+
+	return (e->val + round) / (1 << USTEER_EWMA_SHIFT);
+}
+
 #endif